@@ -0,0 +1,12 @@
+#include <time.h>
+
+#include "bench.h"
+
+double bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
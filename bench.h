@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+# define BENCH_H
+
+/* Microbenchmarks, run with -b|--bench <name> in place of the game.  *
+ * bench_run() returns 0 if the benchmark ran and its self-checks     *
+ * passed.                                                             */
+int bench_run(const char *name);
+
+/* A monotonic clock in seconds.  It's in bench.cpp by itself so that *
+ * mkpokedex can link the pokedex benchmarks without the game; the    *
+ * rest of the benchmarks are in benchmarks.cpp.                      */
+double bench_now();
+
+#endif
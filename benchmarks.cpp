@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstring>
+
+#include "bench.h"
+#include "db_parse.h"
+#include "poke327.h"
+
+#define BENCH_REPS 10
+#define BENCH_MAPS 1000
+#define BENCH_HEAP_MAPS 50
+
+static int bench_tokenizer()
+{
+  return db_bench_tokenizer(BENCH_REPS);
+}
+
+static int bench_export()
+{
+  return db_bench_export(BENCH_REPS);
+}
+
+static int bench_pathfind()
+{
+  return pathfind_bench(BENCH_MAPS);
+}
+
+static int bench_steering()
+{
+  return steering_bench(BENCH_MAPS);
+}
+
+static int bench_heaps()
+{
+  return heap_bench(BENCH_HEAP_MAPS);
+}
+
+static int bench_mapgen()
+{
+  return mapgen_bench(BENCH_MAPS);
+}
+
+static int bench_smooth()
+{
+  return smooth_bench(BENCH_MAPS);
+}
+
+static const struct {
+  const char *name;
+  const char *description;
+  int (*run)();
+} benchmarks[] = {
+  { "tokenizer", "pokemon_moves.csv with next_token/atoi vs. csv scanner",
+    bench_tokenizer },
+  { "export", "pokemon_moves export with sprintf/i2s vs. bulk writer",
+    bench_export },
+  { "pathfind", "hiker/rival distance maps with Fibonacci heap vs. buckets",
+    bench_pathfind },
+  { "steering", "hiker/rival steering from whole maps vs. local A* searches",
+    bench_steering },
+  { "heaps", "pathfind and turn queue traces on each heap backend",
+    bench_heaps },
+  { "mapgen", "new_map() throughput and a checksum of the maps it makes",
+    bench_mapgen },
+  { "smooth", "heightmap gaussian with 5x5 bounds checks vs. separable SIMD",
+    bench_smooth },
+};
+
+#define NUM_BENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+int bench_run(const char *name)
+{
+  unsigned i;
+
+  for (i = 0; i < NUM_BENCHMARKS; i++) {
+    if (!strcmp(name, benchmarks[i].name)) {
+      return benchmarks[i].run();
+    }
+  }
+
+  fprintf(stderr, "Unknown benchmark \"%s\".  Benchmarks are:\n", name);
+  for (i = 0; i < NUM_BENCHMARKS; i++) {
+    fprintf(stderr, "  %-12s %s\n",
+            benchmarks[i].name, benchmarks[i].description);
+  }
+
+  return -1;
+}
@@ -1,7 +1,16 @@
 #include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <unordered_map>
 
 #include "poke327.h"
 #include "io.h"
+#include "bench.h"
+#include "distmap.h"
 
 /***********************************************************************
  * Hack: Avoid the "path to a building" issue by making building cells *
@@ -29,7 +38,9 @@ static void move_hiker_func(character *c, pair_t dest)
   int min;
   int base;
   int i;
+  int around[8];
 
+  pathfind_around(char_hiker, c->pos, around);
   base = rand() & 0x7;
 
   dest[dim_x] = c->pos[dim_x];
@@ -37,17 +48,14 @@ static void move_hiker_func(character *c, pair_t dest)
   min = INT_MAX;
   
   for (i = base; i < 8 + base; i++) {
-    if ((world.hiker_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                         [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] <=
-         min) &&
+    if ((around[i & 0x7] <= min) &&
         !world.cur_map->cmap[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
                             [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]]) {
       dest[dim_x] = c->pos[dim_x] + all_dirs[i & 0x7][dim_x];
       dest[dim_y] = c->pos[dim_y] + all_dirs[i & 0x7][dim_y];
-      min = world.hiker_dist[dest[dim_y]][dest[dim_x]];
+      min = around[i & 0x7];
     }
-    if (world.hiker_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                        [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] == 0) {
+    if (around[i & 0x7] == 0) {
       io_battle(c, &world.pc);
       break;
     }
@@ -59,7 +67,9 @@ static void move_rival_func(character *c, pair_t dest)
   int min;
   int base;
   int i;
+  int around[8];
   
+  pathfind_around(char_rival, c->pos, around);
   base = rand() & 0x7;
 
   dest[dim_x] = c->pos[dim_x];
@@ -67,17 +77,14 @@ static void move_rival_func(character *c, pair_t dest)
   min = INT_MAX;
   
   for (i = base; i < 8 + base; i++) {
-    if ((world.rival_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                         [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] <
-         min) &&
+    if ((around[i & 0x7] < min) &&
         !world.cur_map->cmap[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
                             [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]]) {
       dest[dim_x] = c->pos[dim_x] + all_dirs[i & 0x7][dim_x];
       dest[dim_y] = c->pos[dim_y] + all_dirs[i & 0x7][dim_y];
-      min = world.rival_dist[dest[dim_y]][dest[dim_x]];
+      min = around[i & 0x7];
     }
-    if (world.rival_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                        [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] == 0) {
+    if (around[i & 0x7] == 0) {
       io_battle(c, &world.pc);
       break;
     }
@@ -239,11 +246,17 @@ static int32_t rival_cmp(const void *key, const void *with) {
                           [((path_t *) with)->pos[dim_x]]);
 }
 
-void pathfind(map_t *m)
+/* The Fibonacci heap Dijkstra that pathfind() used to be.  Only the  *
+ * pathfind benchmark calls it now, as the reference for the bucket   *
+ * queue.  It stops at the first cell the PC can't be reached from;   *
+ * going on, it added move costs to INT_MAX, and the overflowed keys   *
+ * could corrupt the heap.                                             */
+static void heap_pathfind(map_t *m)
 {
   heap_t h;
   uint32_t x, y;
   static path_t p[MAP_Y][MAP_X], *c;
+  static heap_node_t nodes[MAP_Y * MAP_X];
   static uint32_t initialized = 0;
 
   if (!initialized) {
@@ -265,6 +278,7 @@ void pathfind(map_t *m)
     world.rival_dist[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = 0;
 
   heap_init(&h, hiker_cmp, NULL);
+  heap_add_nodes(&h, nodes, MAP_Y * MAP_X);
 
   for (y = 1; y < MAP_Y - 1; y++) {
     for (x = 1; x < MAP_X - 1; x++) {
@@ -278,6 +292,9 @@ void pathfind(map_t *m)
 
   while ((c = (path_t *) heap_remove_min(&h))) {
     c->hn = NULL;
+    if (world.hiker_dist[c->pos[dim_y]][c->pos[dim_x]] == INT_MAX) {
+      break;
+    }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
         (world.hiker_dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
          world.hiker_dist[c->pos[dim_y]][c->pos[dim_x]] +
@@ -362,6 +379,7 @@ void pathfind(map_t *m)
   heap_delete(&h);
 
   heap_init(&h, rival_cmp, NULL);
+  heap_add_nodes(&h, nodes, MAP_Y * MAP_X);
 
   for (y = 1; y < MAP_Y - 1; y++) {
     for (x = 1; x < MAP_X - 1; x++) {
@@ -375,6 +393,9 @@ void pathfind(map_t *m)
 
   while ((c = (path_t *) heap_remove_min(&h))) {
     c->hn = NULL;
+    if (world.rival_dist[c->pos[dim_y]][c->pos[dim_x]] == INT_MAX) {
+      break;
+    }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
         (world.rival_dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
          world.rival_dist[c->pos[dim_y]][c->pos[dim_x]] +
@@ -458,3 +479,676 @@ void pathfind(map_t *m)
   }
   heap_delete(&h);
 }
+
+/* The distance maps depend only on the terrain, which never changes *
+ * once a map is generated, and on where the PC was when pathfind()   *
+ * was called.  pathfind() only records that; a map is computed when  *
+ * something is about to read it and calls pathfind_need(), so turns  *
+ * where no hiker or rival moves, or where all of them were beaten     *
+ * and wander, don't compute anything.  Moving the PC by even one cell *
+ * changes most distances (about 80% of reachable cells on generated   *
+ * maps), so a stale map is recomputed rather than repaired.           */
+typedef struct dist_field {
+  character_type_t ctype;
+  int (*dist)[MAP_X];
+  const map_t *map;     /* What dist was last computed for  */
+  pair_t source;
+  int used;             /* Needed since the source moved    */
+  int was_used;         /* Needed for the source before it  */
+  int local_work;       /* Cells pathfind_around() expanded */
+  int near;             /* Pursuers near source, -1 unknown */
+} dist_field_t;
+
+static dist_field_t hiker_field = { char_hiker, world.hiker_dist, NULL,
+                                     { 0, 0 }, 0, 0, 0, -1 };
+static dist_field_t rival_field = { char_rival, world.rival_dist, NULL,
+                                     { 0, 0 }, 0, 0, 0, -1 };
+static const map_t *dist_map_for;
+static pair_t dist_source;
+
+static int dist_fresh(const dist_field_t *f)
+{
+  return (f->map == dist_map_for &&
+          f->source[dim_x] == dist_source[dim_x] &&
+          f->source[dim_y] == dist_source[dim_y]);
+}
+
+static void dist_compute(dist_field_t *f, const map_t *m, const pair_t source)
+{
+  if (f->ctype == char_hiker) {
+    dist_map<char_hiker>(m, source, f->dist);
+  } else {
+    dist_map<char_rival>(m, source, f->dist);
+  }
+}
+
+/* The hiker and rival maps share nothing but the terrain they read, *
+ * so when one is needed and the other was needed for the last source *
+ * too, a worker computes the other one at the same time, on hosts    *
+ * with more than one core.  The worker is started on first use and  *
+ * then waits for the next map; each map is written by exactly one    *
+ * thread, so the result doesn't depend on timing.                    */
+static std::mutex dist_lock;
+static std::condition_variable dist_wake, dist_done;
+static std::thread dist_worker;
+static dist_field_t *dist_job;
+static const map_t *dist_job_map;
+static pair_t dist_job_source;
+static bool dist_quit;
+
+static void dist_main()
+{
+  std::unique_lock<std::mutex> l(dist_lock);
+
+  for (;;) {
+    dist_wake.wait(l, []() { return dist_job || dist_quit; });
+    if (!dist_job) {
+      return;
+    }
+
+    l.unlock();
+    dist_compute(dist_job, dist_job_map, dist_job_source);
+    l.lock();
+
+    dist_job = NULL;
+    dist_done.notify_one();
+  }
+}
+
+static void dist_join()
+{
+  {
+    std::lock_guard<std::mutex> l(dist_lock);
+    dist_quit = true;
+  }
+  dist_wake.notify_one();
+  dist_worker.join();
+}
+
+static void dist_compute_both(dist_field_t *f, dist_field_t *other)
+{
+  if (!dist_worker.joinable()) {
+    dist_worker = std::thread(dist_main);
+    atexit(dist_join);
+  }
+
+  {
+    std::lock_guard<std::mutex> l(dist_lock);
+    dist_job = other;
+    dist_job_map = dist_map_for;
+    dist_job_source[dim_x] = dist_source[dim_x];
+    dist_job_source[dim_y] = dist_source[dim_y];
+  }
+  dist_wake.notify_one();
+
+  dist_compute(f, dist_map_for, dist_source);
+
+  std::unique_lock<std::mutex> l(dist_lock);
+  dist_done.wait(l, []() { return !dist_job; });
+}
+
+void pathfind(map_t *m)
+{
+  if (m == dist_map_for &&
+      world.pc.pos[dim_x] == dist_source[dim_x] &&
+      world.pc.pos[dim_y] == dist_source[dim_y]) {
+    return;
+  }
+
+  dist_map_for = m;
+  dist_source[dim_x] = world.pc.pos[dim_x];
+  dist_source[dim_y] = world.pc.pos[dim_y];
+
+  hiker_field.was_used = hiker_field.used;
+  rival_field.was_used = rival_field.used;
+  hiker_field.used = rival_field.used = 0;
+  hiker_field.local_work = rival_field.local_work = 0;
+  hiker_field.near = rival_field.near = -1;
+}
+
+void pathfind_need(character_type_t ctype)
+{
+  static const bool parallel = std::thread::hardware_concurrency() > 1;
+  dist_field_t *f, *other;
+
+  if (ctype == char_hiker) {
+    f = &hiker_field;
+    other = &rival_field;
+  } else {
+    f = &rival_field;
+    other = &hiker_field;
+  }
+
+  f->used = 1;
+  if (!dist_map_for || dist_fresh(f)) {
+    return;
+  }
+
+  if (parallel && other->was_used && !dist_fresh(other)) {
+    dist_compute_both(f, other);
+    other->map = dist_map_for;
+    other->source[dim_x] = dist_source[dim_x];
+    other->source[dim_y] = dist_source[dim_y];
+  } else {
+    dist_compute(f, dist_map_for, dist_source);
+  }
+
+  f->map = dist_map_for;
+  f->source[dim_x] = dist_source[dim_x];
+  f->source[dim_y] = dist_source[dim_y];
+}
+
+/* For a map that's new, though it may live where a freed one did. */
+void pathfind_invalidate()
+{
+  hiker_field.map = rival_field.map = NULL;
+  hiker_field.local_work = rival_field.local_work = 0;
+  hiker_field.near = rival_field.near = -1;
+}
+
+/* Hikers and rivals only look at the eight cells around them, so with *
+ * only a few of them chasing the PC, and close to it, answering each   *
+ * one with a small A* search (dist_targets()) beats computing a whole  *
+ * map.  A pursuer farther than STEER_NEAR cells would expand most of   *
+ * the map anyway, and the searches of more than STEER_MAX_LOCAL near   *
+ * ones add up to more than the map, so both go to the whole map.  The  *
+ * searches for one source share a budget of a quarter of a map's       *
+ * cells; once it runs out, the whole map is computed and serves        *
+ * everyone else.  Either way the distances are the same.  -b steering  *
+ * compares the two.                                                    */
+#define STEER_NEAR      8
+#define STEER_MAX_LOCAL 4
+#define STEER_BUDGET    (MAP_X * MAP_Y / 4)
+
+static int steer_is_near(const pair_t pos)
+{
+  return (abs(pos[dim_x] - dist_source[dim_x]) <= STEER_NEAR &&
+          abs(pos[dim_y] - dist_source[dim_y]) <= STEER_NEAR);
+}
+
+/* Undefeated NPCs of f's type within STEER_NEAR cells of the source. */
+static int steer_count_near(const dist_field_t *f)
+{
+  int x, y, n;
+  npc *c;
+
+  for (n = 0, y = std::max(dist_source[dim_y] - STEER_NEAR, 1);
+       y <= std::min(dist_source[dim_y] + STEER_NEAR, MAP_Y - 2); y++) {
+    for (x = std::max(dist_source[dim_x] - STEER_NEAR, 1);
+         x <= std::min(dist_source[dim_x] + STEER_NEAR, MAP_X - 2); x++) {
+      if ((c = dynamic_cast<npc *>(dist_map_for->cmap[y][x])) &&
+          c->ctype == f->ctype && !c->defeated) {
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
+static int steer_local = 1;
+
+void pathfind_around(character_type_t ctype, const pair_t pos, int around[8])
+{
+  static dist_scratch_t scratch;
+  dist_field_t *f;
+  pair_t targets[8];
+  int i, work;
+
+  f = ctype == char_hiker ? &hiker_field : &rival_field;
+
+  if (steer_local && dist_map_for && !dist_fresh(f) &&
+      f->local_work < STEER_BUDGET && steer_is_near(pos) &&
+      (f->near >= 0 ? f->near : (f->near = steer_count_near(f))) <=
+      STEER_MAX_LOCAL) {
+    for (i = 0; i < 8; i++) {
+      targets[i][dim_x] = pos[dim_x] + all_dirs[i][dim_x];
+      targets[i][dim_y] = pos[dim_y] + all_dirs[i][dim_y];
+    }
+    if (ctype == char_hiker) {
+      work = dist_targets<char_hiker>(dist_map_for, dist_source, targets, 8,
+                                      around, &scratch,
+                                      STEER_BUDGET - f->local_work);
+    } else {
+      work = dist_targets<char_rival>(dist_map_for, dist_source, targets, 8,
+                                      around, &scratch,
+                                      STEER_BUDGET - f->local_work);
+    }
+    if (work >= 0) {
+      f->local_work += work;
+
+      return;
+    }
+    f->local_work = STEER_BUDGET;
+  }
+
+  pathfind_need(ctype);
+  for (i = 0; i < 8; i++) {
+    around[i] = f->dist[pos[dim_y] + all_dirs[i][dim_y]]
+                       [pos[dim_x] + all_dirs[i][dim_x]];
+  }
+}
+
+/* Generates maps from seeds 1 through maps, and from a handful of spots *
+ * the PC could stand on in each, times both engines and checks that     *
+ * they agree.                                                           */
+int pathfind_bench(int maps)
+{
+  static int hiker[MAP_Y][MAP_X], rival[MAP_Y][MAP_X];
+  double t, heap_time, dial_time;
+  pair_t pc;
+  int i, j, runs, differ;
+
+  for (heap_time = dial_time = 0, runs = differ = 0, i = 1; i <= maps; i++) {
+    srand(i);
+    init_world();
+    pc[dim_x] = world.pc.pos[dim_x];
+    pc[dim_y] = world.pc.pos[dim_y];
+
+    for (j = 0; j < 4; j++, runs++) {
+      do {
+        world.pc.pos[dim_x] = rand_range(1, MAP_X - 2);
+        world.pc.pos[dim_y] = rand_range(1, MAP_Y - 2);
+      } while (move_cost[char_pc][world.cur_map->map[world.pc.pos[dim_y]]
+                                                    [world.pc.pos[dim_x]]] ==
+               INT_MAX);
+
+      t = bench_now();
+      heap_pathfind(world.cur_map);
+      heap_time += bench_now() - t;
+      memcpy(hiker, world.hiker_dist, sizeof (hiker));
+      memcpy(rival, world.rival_dist, sizeof (rival));
+
+      t = bench_now();
+      pathfind_invalidate();
+      pathfind(world.cur_map);
+      pathfind_need(char_hiker);
+      pathfind_need(char_rival);
+      dial_time += bench_now() - t;
+
+      if (memcmp(hiker, world.hiker_dist, sizeof (hiker)) ||
+          memcmp(rival, world.rival_dist, sizeof (rival))) {
+        differ++;
+      }
+    }
+
+    world.pc.pos[dim_x] = pc[dim_x];
+    world.pc.pos[dim_y] = pc[dim_y];
+    delete_world();
+  }
+
+  printf("pathfind: %d maps, %d PC positions\n", maps, runs);
+  printf("  Fibonacci heap: %8.2f us per call\n", heap_time * 1e6 / runs);
+  printf("  bucket queue:   %8.2f us per call\n", dial_time * 1e6 / runs);
+  printf("  speedup %.2fx, %d distance maps differ\n",
+         heap_time / dial_time, differ);
+
+  return differ != 0;
+}
+
+/* Steers 1, 2, 4 and 8 pursuers of each kind per map, placed anywhere *
+ * and within STEER_NEAR cells of the PC, from whole maps and from      *
+ * local searches, and checks that they see the same distances.  The    *
+ * pursuers stand on the map next to the ones it was made with, so      *
+ * pathfind_around() counts all of them.                                */
+int steering_bench(int maps)
+{
+  static const int pursuers[] = { 1, 2, 4, 8 };
+  static const char *const placement[] = { "anywhere", "near the PC" };
+  static npc pursuer[8];
+  pair_t pos[8];
+  int full[8][8], local[8][8];
+  double t, full_time[2][4], local_time[2][4];
+  int i, j, k, p, near, runs, differ;
+  character_type_t ctype;
+
+  memset(full_time, 0, sizeof (full_time));
+  memset(local_time, 0, sizeof (local_time));
+
+  for (runs = differ = 0, i = 1; i <= maps; i++) {
+    srand(i);
+    init_world();
+
+    for (near = 0; near < 2; near++) {
+      for (p = 0; p < 4; p++) {
+        for (k = 0; k < 2; k++, runs++) {
+          ctype = k ? char_rival : char_hiker;
+          for (j = 0; j < pursuers[p]; j++) {
+            do {
+              rand_pos(pos[j]);
+            } while ((move_cost[ctype][world.cur_map->map[pos[j][dim_y]]
+                                                         [pos[j][dim_x]]] ==
+                      INT_MAX) ||
+                     world.cur_map->cmap[pos[j][dim_y]][pos[j][dim_x]] ||
+                     (near &&
+                      (abs(pos[j][dim_x] - world.pc.pos[dim_x]) > STEER_NEAR ||
+                       abs(pos[j][dim_y] - world.pc.pos[dim_y]) > STEER_NEAR)));
+            pursuer[j].ctype = ctype;
+            pursuer[j].defeated = 0;
+            world.cur_map->cmap[pos[j][dim_y]][pos[j][dim_x]] = &pursuer[j];
+          }
+
+          steer_local = 0;
+          t = bench_now();
+          pathfind_invalidate();
+          for (j = 0; j < pursuers[p]; j++) {
+            pathfind_around(ctype, pos[j], full[j]);
+          }
+          full_time[near][p] += bench_now() - t;
+
+          steer_local = 1;
+          t = bench_now();
+          pathfind_invalidate();
+          for (j = 0; j < pursuers[p]; j++) {
+            pathfind_around(ctype, pos[j], local[j]);
+          }
+          local_time[near][p] += bench_now() - t;
+
+          for (j = 0; j < pursuers[p]; j++) {
+            world.cur_map->cmap[pos[j][dim_y]][pos[j][dim_x]] = NULL;
+          }
+
+          if (memcmp(full, local, pursuers[p] * sizeof (full[0]))) {
+            differ++;
+          }
+        }
+      }
+    }
+
+    delete_world();
+  }
+
+  printf("steering: %d maps, hikers and rivals, us per turn\n", maps);
+  for (near = 0; near < 2; near++) {
+    printf("  pursuers %s:\n", placement[near]);
+    for (p = 0; p < 4; p++) {
+      printf("    %d: whole map %8.2f, local search %8.2f, %.2fx\n",
+             pursuers[p], full_time[near][p] * 1e6 / (2 * maps),
+             local_time[near][p] * 1e6 / (2 * maps),
+             full_time[near][p] / local_time[near][p]);
+    }
+  }
+  printf("  %d of %d runs differ\n", differ, runs);
+
+  return differ != 0;
+}
+
+/* Queue traffic recorded through heap_trace, to be replayed against  *
+ * each heap backend.  Every insert starts a new instance of its datum, *
+ * and the instance's rank is its place in the order the recording     *
+ * removed instances in (UINT32_MAX if it never was).  Ordered by key   *
+ * and then rank, every backend must remove the instances in exactly   *
+ * that order, and the keys stay monotone for the radix heap.           */
+enum heap_trace_kind {
+  trace_pathfind,
+  trace_turns,
+  num_trace_kinds
+};
+
+typedef struct heap_trace_op {
+  heap_op_t op;
+  uint32_t instance;
+  int32_t key;
+} heap_trace_op_t;
+
+typedef struct heap_trace_session {
+  std::vector<heap_trace_op_t> ops;
+  std::vector<uint32_t> rank;
+  uint32_t removed;
+} heap_trace_session_t;
+
+static std::vector<heap_trace_session_t> traces[num_trace_kinds];
+static std::unordered_map<const heap_t *, heap_trace_session_t *> tracing;
+static std::unordered_map<const void *, uint32_t> trace_instance;
+
+static void heap_record(const heap_t *h, heap_op_t op, const void *v)
+{
+  heap_trace_session_t *s;
+  heap_trace_kind kind;
+  int32_t key;
+
+  if (!tracing.count(h)) {
+    if (op == heap_op_delete) {
+      return;
+    }
+    if (h->compare == cmp_char_turns) {
+      kind = trace_turns;
+    } else {
+      kind = trace_pathfind;
+    }
+    traces[kind].emplace_back();
+    tracing[h] = &traces[kind].back();
+    tracing[h]->removed = 0;
+  }
+  s = tracing[h];
+
+  if (op == heap_op_delete) {
+    s->ops.push_back({ op, 0, 0 });
+    tracing.erase(h);
+    return;
+  }
+
+  if (h->compare == cmp_char_turns) {
+    key = ((character *) v)->next_turn;
+  } else {
+    key = (h->compare == hiker_cmp ? world.hiker_dist : world.rival_dist)
+          [((path_t *) v)->pos[dim_y]][((path_t *) v)->pos[dim_x]];
+  }
+
+  if (op == heap_op_insert) {
+    trace_instance[v] = s->rank.size();
+    s->rank.push_back(UINT32_MAX);
+  } else if (op == heap_op_remove) {
+    s->rank[trace_instance[v]] = s->removed++;
+  }
+  s->ops.push_back({ op, trace_instance[v], key });
+}
+
+typedef struct heap_replay_item {
+  int64_t key;
+  uint32_t rank;
+  heap_node_t *hn;
+  int removed;
+} heap_replay_item_t;
+
+static int32_t replay_cmp(const void *key, const void *with)
+{
+  const heap_replay_item_t *k = (const heap_replay_item_t *) key;
+  const heap_replay_item_t *w = (const heap_replay_item_t *) with;
+
+  if (k->key != w->key) {
+    return k->key < w->key ? -1 : 1;
+  }
+
+  return k->rank < w->rank ? -1 : k->rank > w->rank;
+}
+
+static uint64_t replay_key(const void *v)
+{
+  return (((uint64_t) ((const heap_replay_item_t *) v)->key) << 32 |
+          ((const heap_replay_item_t *) v)->rank);
+}
+
+/* Replays a session against backend b, and returns the number of      *
+ * removals that don't match the recording.                            */
+static int heap_replay(const heap_trace_session_t *s, heap_backend_t b,
+                       std::vector<heap_replay_item_t> &items,
+                       std::vector<heap_node_t> &nodes)
+{
+  heap_replay_item_t *r;
+  heap_t h;
+  uint32_t removed;
+  int wrong;
+
+  items.resize(s->rank.size());
+  nodes.resize(s->rank.size());
+  heap_init_backend(&h, b, replay_cmp, replay_key, NULL);
+  heap_add_nodes(&h, nodes.data(), nodes.size());
+
+  wrong = removed = 0;
+  for (const heap_trace_op_t &o : s->ops) {
+    switch (o.op) {
+    case heap_op_insert:
+      items[o.instance].key = o.key;
+      items[o.instance].rank = s->rank[o.instance];
+      items[o.instance].hn = heap_insert(&h, &items[o.instance]);
+      break;
+    case heap_op_remove:
+      r = (heap_replay_item_t *) heap_remove_min(&h);
+      wrong += !r || r->rank != removed++;
+      break;
+    case heap_op_decrease:
+      items[o.instance].key = o.key;
+      heap_decrease_key_no_replace(&h, items[o.instance].hn);
+      break;
+    case heap_op_delete:
+      heap_delete(&h);
+      return wrong;
+    }
+  }
+  heap_delete(&h);
+
+  return wrong;
+}
+
+/* The same against pqueue, which has no decrease-key: a decrease       *
+ * queues the instance again, and stale entries are skipped as they     *
+ * come out.                                                            */
+static int pqueue_replay(const heap_trace_session_t *s,
+                         std::vector<heap_replay_item_t> &items)
+{
+  pqueue<uint64_t, uint32_t> q;
+  uint64_t key;
+  uint32_t i, removed;
+  int wrong;
+
+  items.resize(s->rank.size());
+  q.init();
+
+  wrong = removed = 0;
+  for (const heap_trace_op_t &o : s->ops) {
+    switch (o.op) {
+    case heap_op_insert:
+    case heap_op_decrease:
+      items[o.instance].key = o.key;
+      items[o.instance].rank = s->rank[o.instance];
+      items[o.instance].removed = 0;
+      q.insert(replay_key(&items[o.instance]), o.instance);
+      break;
+    case heap_op_remove:
+      do {
+        i = q.size() ? q.remove_min(&key) : UINT32_MAX;
+      } while (i != UINT32_MAX &&
+               (items[i].removed || key != replay_key(&items[i])));
+      if (i != UINT32_MAX) {
+        items[i].removed = 1;
+      }
+      wrong += i == UINT32_MAX || items[i].rank != removed++;
+      break;
+    case heap_op_delete:
+      q.destroy();
+      return wrong;
+    }
+  }
+  q.destroy();
+
+  return wrong;
+}
+
+/* Records the queues of heap_pathfind() from a few PC positions and  *
+ * a heap_t turn queue over HEAP_BENCH_TURNS turns with nobody moving, *
+ * then replays them against every backend.                            */
+#define HEAP_BENCH_TURNS 1000
+
+int heap_bench(int maps)
+{
+  static const char *const backend_name[num_heap_backends] = {
+    "Fibonacci", "pairing", "4-ary", "radix",
+  };
+  static const char *const kind_name[num_trace_kinds] = {
+    "pathfind", "turn queue",
+  };
+  std::vector<heap_replay_item_t> items;
+  std::vector<heap_node_t> nodes;
+  double t, time[num_trace_kinds][num_heap_backends + 1];
+  size_t ops[num_trace_kinds];
+  character *c;
+  heap_t turn;
+  pair_t pc;
+  int i, j, k, b, wrong;
+
+  heap_trace = heap_record;
+  for (i = 1; i <= maps; i++) {
+    srand(i);
+    init_world();
+    pc[dim_x] = world.pc.pos[dim_x];
+    pc[dim_y] = world.pc.pos[dim_y];
+
+    for (j = 0; j < 2; j++) {
+      do {
+        world.pc.pos[dim_x] = rand_range(1, MAP_X - 2);
+        world.pc.pos[dim_y] = rand_range(1, MAP_Y - 2);
+      } while (move_cost[char_pc][world.cur_map->map[world.pc.pos[dim_y]]
+                                                    [world.pc.pos[dim_x]]] ==
+               INT_MAX);
+      heap_pathfind(world.cur_map);
+    }
+    world.pc.pos[dim_x] = pc[dim_x];
+    world.pc.pos[dim_y] = pc[dim_y];
+
+    heap_init(&turn, cmp_char_turns, NULL);
+    for (j = 0; j < (int) world.cur_map->turn.size(); j++) {
+      heap_insert(&turn, world.cur_map->turn[j].value);
+    }
+    for (j = 0; j < HEAP_BENCH_TURNS; j++) {
+      c = (character *) heap_remove_min(&turn);
+      c->next_turn +=
+        move_cost[dynamic_cast<npc *>(c) ? ((npc *) c)->ctype : char_pc]
+                 [world.cur_map->map[c->pos[dim_y]][c->pos[dim_x]]];
+      heap_insert(&turn, c);
+    }
+    heap_delete(&turn);
+
+    delete_world();
+    pathfind_invalidate();
+  }
+  heap_trace = NULL;
+  trace_instance.clear();
+
+  memset(time, 0, sizeof (time));
+  for (wrong = k = 0; k < num_trace_kinds; k++) {
+    ops[k] = 0;
+    for (const heap_trace_session_t &s : traces[k]) {
+      ops[k] += s.ops.size();
+    }
+    for (b = 0; b < num_heap_backends; b++) {
+      t = bench_now();
+      for (const heap_trace_session_t &s : traces[k]) {
+        wrong += heap_replay(&s, (heap_backend_t) b, items, nodes);
+      }
+      time[k][b] = bench_now() - t;
+    }
+    t = bench_now();
+    for (const heap_trace_session_t &s : traces[k]) {
+      wrong += pqueue_replay(&s, items);
+    }
+    time[k][b] = bench_now() - t;
+  }
+
+  printf("heaps: %d maps, replayed operation traces, ns per operation\n",
+         maps);
+  for (k = 0; k < num_trace_kinds; k++) {
+    printf("  %s: %zu queues, %zu operations\n",
+           kind_name[k], traces[k].size(), ops[k]);
+    for (b = 0; b < num_heap_backends; b++) {
+      printf("    %-10s %8.2f, %.2fx\n", backend_name[b],
+             time[k][b] * 1e9 / ops[k], time[k][0] / time[k][b]);
+    }
+    printf("    %-10s %8.2f, %.2fx\n", "pqueue",
+           time[k][b] * 1e9 / ops[k], time[k][0] / time[k][b]);
+    traces[k].clear();
+  }
+  printf("  %d removals out of order\n", wrong);
+
+  return wrong != 0;
+}
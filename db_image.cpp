@@ -0,0 +1,432 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "db_parse.h"
+#include "db_image.h"
+
+/* Bump DB_IMAGE_VERSION whenever the layout of the image or of any of the *
+ * structs in db_parse.h changes.  Old images are then simply reparsed.    *
+ *                                                                         *
+ * The image is laid out so that it can be mapped read-only and used in    *
+ * place: a header with a section directory, followed by each table at an  *
+ * aligned offset, exactly as it sits in memory.  Every game on the host   *
+ * then shares the one copy in the page cache.  Each section carries its   *
+ * own checksum, so a table is only read once it's actually wanted.        */
+#define DB_IMAGE_MAGIC   "P327IMG"
+#define DB_IMAGE_VERSION 6
+#define DB_IMAGE_ALIGN   64
+#define DB_IMAGE_DIR     "/.poke327"
+#define DB_IMAGE_NAME    "/.poke327/pokedex.img"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static const char *db_sources[] = {
+  "pokemon.csv",
+  "moves.csv",
+  "pokemon_moves.csv",
+  "pokemon_species.csv",
+  "experience.csv",
+  "type_names.csv",
+  "pokemon_stats.csv",
+  "stats.csv",
+  "pokemon_types.csv",
+};
+
+#define NUM_SOURCES (sizeof (db_sources) / sizeof (db_sources[0]))
+
+typedef struct db_image_source {
+  int64_t mtime;
+  int64_t size;
+  uint64_t hash;
+} db_image_source_t;
+
+typedef struct db_image_section {
+  uint32_t elem_size;
+  uint32_t count;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t checksum;
+} db_image_section_t;
+
+typedef struct db_image_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t source_count;
+  db_image_source_t source[NUM_SOURCES];
+  uint32_t section_count;
+  uint32_t pad;
+  db_image_section_t section[num_tables];
+  uint64_t payload_size;
+} db_image_header_t;
+
+#define TYPE_NULL UINT32_MAX
+
+/* The image stays mapped for the life of the process. */
+static const char *image;
+static const char *image_types[NUM_TYPES];
+
+/* FNV-1a, folded in a word at a time.  Every step is a bijection on h, *
+ * so any single corrupted word is guaranteed to change the result.     */
+static uint64_t db_hash(uint64_t h, const void *v, size_t n)
+{
+  const unsigned char *p = (const unsigned char *) v;
+  uint64_t w;
+
+  for (; n >= sizeof (w); n -= sizeof (w), p += sizeof (w)) {
+    memcpy(&w, p, sizeof (w));
+    h = (h ^ w) * FNV_PRIME;
+  }
+  for (; n; n--, p++) {
+    h = (h ^ *p) * FNV_PRIME;
+  }
+
+  return h;
+}
+
+static char *db_home_path(const char *name)
+{
+  char *path;
+  const char *home;
+
+  if (!(home = getenv("HOME"))) {
+    return NULL;
+  }
+
+  path = (char *) malloc(strlen(home) + strlen(name) + 1);
+  strcpy(path, home);
+  strcat(path, name);
+
+  return path;
+}
+
+static char *db_source_path(const char *prefix, const char *name)
+{
+  char *path;
+
+  path = (char *) malloc(strlen(prefix) + strlen(name) + 1);
+  strcpy(path, prefix);
+  strcat(path, name);
+
+  return path;
+}
+
+static int db_hash_file(const char *path, uint64_t *hash)
+{
+  FILE *f;
+  char buf[65536];
+  size_t n;
+
+  if (!(f = fopen(path, "rb"))) {
+    return 1;
+  }
+
+  *hash = FNV_OFFSET;
+  while ((n = fread(buf, 1, sizeof (buf), f))) {
+    *hash = db_hash(*hash, buf, n);
+  }
+  fclose(f);
+
+  return 0;
+}
+
+static int db_stamp_sources(const char *prefix,
+                            db_image_source_t source[NUM_SOURCES])
+{
+  struct stat buf;
+  char *path;
+  uint32_t i;
+  int err;
+
+  for (err = 0, i = 0; !err && i < NUM_SOURCES; i++) {
+    path = db_source_path(prefix, db_sources[i]);
+    err = (stat(path, &buf) || db_hash_file(path, &source[i].hash));
+    source[i].mtime = buf.st_mtime;
+    source[i].size = buf.st_size;
+    free(path);
+  }
+
+  return err;
+}
+
+/* A source is unchanged if its mtime and size match.  If only the mtime *
+ * moved (a fresh checkout, touch, cp without -p), fall back to hashing  *
+ * the contents before we throw the image away.                          */
+static int db_sources_changed(const char *prefix,
+                              const db_image_source_t source[NUM_SOURCES])
+{
+  struct stat buf;
+  char *path;
+  uint64_t hash;
+  uint32_t i;
+  int changed;
+
+  for (changed = 0, i = 0; !changed && i < NUM_SOURCES; i++) {
+    path = db_source_path(prefix, db_sources[i]);
+    if (stat(path, &buf) || buf.st_size != source[i].size) {
+      changed = 1;
+    } else if (buf.st_mtime != source[i].mtime) {
+      changed = db_hash_file(path, &hash) || hash != source[i].hash;
+    }
+    free(path);
+  }
+
+  return changed;
+}
+
+static int db_write(FILE *f, const void *v, size_t n)
+{
+  return fwrite(v, 1, n, f) != n;
+}
+
+static int db_write_padding(FILE *f, uint64_t to)
+{
+  static const char zero[DB_IMAGE_ALIGN] = { 0 };
+  long at;
+
+  at = ftell(f);
+
+  return at < 0 || db_write(f, zero, to - at);
+}
+
+static uint64_t db_align(uint64_t offset)
+{
+  return (offset + DB_IMAGE_ALIGN - 1) & ~((uint64_t) DB_IMAGE_ALIGN - 1);
+}
+
+/* Sizes of every table; a count of 0 means that it depends on the data. */
+static const struct {
+  uint32_t elem_size;
+  uint32_t count;
+} db_layout[num_tables] = {
+  { sizeof (pokemon_move_columns), 1                 },
+  { sizeof (pokemon_db),           NUM_POKEMON       },
+  { sizeof (move_db),              NUM_MOVES         },
+  { sizeof (experience_db),        NUM_EXPERIENCE    },
+  { sizeof (pokemon_stats_db),     NUM_POKEMON_STATS },
+  { sizeof (stats_db),             NUM_STATS         },
+  { sizeof (pokemon_types_db),     NUM_POKEMON_TYPES },
+  { sizeof (pokemon_species_db),   NUM_SPECIES       },
+  { sizeof (uint32_t),             NUM_TYPES         },
+  { sizeof (uint32_t),             NUM_SPECIES + 1   },
+  { sizeof (levelup_move),         0                 },
+  { sizeof (char),                 0                 },
+};
+
+int db_image_open(const char *prefix)
+{
+  const db_image_header_t *h;
+  struct stat buf;
+  const char *map;
+  char *path;
+  uint32_t i;
+  int fd;
+
+  if (!prefix || !(path = db_home_path(DB_IMAGE_NAME))) {
+    return 1;
+  }
+
+  fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0) {
+    return 1;
+  }
+
+  if (fstat(fd, &buf) || (size_t) buf.st_size < sizeof (*h) ||
+      (map = (const char *) mmap(NULL, buf.st_size, PROT_READ,
+                                 MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  h = (const db_image_header_t *) map;
+
+  if (memcmp(h->magic, DB_IMAGE_MAGIC, sizeof (h->magic)) ||
+      h->version != DB_IMAGE_VERSION                      ||
+      h->source_count != NUM_SOURCES                      ||
+      h->section_count != num_tables                      ||
+      h->payload_size != buf.st_size - sizeof (*h)        ||
+      db_sources_changed(prefix, h->source)) {
+    munmap((void *) map, buf.st_size);
+    return 1;
+  }
+
+  for (i = 0; i < num_tables; i++) {
+    if (h->section[i].offset < sizeof (*h)                                ||
+        h->section[i].offset % DB_IMAGE_ALIGN                              ||
+        h->section[i].offset + h->section[i].size > (uint64_t) buf.st_size ||
+        h->section[i].elem_size != db_layout[i].elem_size                  ||
+        (db_layout[i].count && h->section[i].count != db_layout[i].count) ||
+        (i != table_types && h->section[i].size !=
+         (uint64_t) h->section[i].elem_size * h->section[i].count)) {
+      munmap((void *) map, buf.st_size);
+      return 1;
+    }
+  }
+
+  image = map;
+
+  return 0;
+}
+
+const void *db_image_table(db_table t, uint64_t *size)
+{
+  const db_image_header_t *h = (const db_image_header_t *) image;
+  const char *v;
+  const uint32_t *type_offset;
+  uint32_t i;
+
+  if (!image) {
+    return NULL;
+  }
+
+  v = image + h->section[t].offset;
+  *size = h->section[t].size;
+
+  if (db_hash(FNV_OFFSET, v, h->section[t].size) != h->section[t].checksum) {
+    return NULL;
+  }
+
+  if (t == table_learnset &&
+      (((const uint32_t *) (image + h->section[table_learnset_offset].offset))
+       [NUM_SPECIES] != h->section[table_learnset].count)) {
+    return NULL;
+  }
+
+  if (t == table_types) {
+    type_offset = (const uint32_t *) v;
+    for (i = 0; i < NUM_TYPES; i++) {
+      if (type_offset[i] != TYPE_NULL &&
+          (type_offset[i] >= h->section[t].size ||
+           !memchr(v + type_offset[i], 0,
+                   h->section[t].size - type_offset[i]))) {
+        return NULL;
+      }
+      image_types[i] = ((type_offset[i] == TYPE_NULL) ?
+                        NULL                          :
+                        v + type_offset[i]);
+    }
+    return image_types;
+  }
+
+  return v;
+}
+
+int db_image_save(const char *prefix)
+{
+  db_image_header_t h;
+  const void *base[num_tables];
+  char *type_section;
+  uint32_t *type_offset;
+  FILE *f;
+  char *path, *tmp, *dir;
+  uint64_t offset;
+  uint32_t i, len;
+  int err;
+
+  if (!prefix || !(path = db_home_path(DB_IMAGE_NAME))) {
+    return 1;
+  }
+
+  memset(&h, 0, sizeof (h));
+  memcpy(h.magic, DB_IMAGE_MAGIC, sizeof (h.magic));
+  h.version = DB_IMAGE_VERSION;
+  h.source_count = NUM_SOURCES;
+  h.section_count = num_tables;
+
+  if (db_stamp_sources(prefix, h.source)) {
+    free(path);
+    return 1;
+  }
+
+  /* Strings are packed right behind the offset table. */
+  for (len = NUM_TYPES * sizeof (*type_offset), i = 0; i < NUM_TYPES; i++) {
+    if (types[i]) {
+      len += strlen(types[i]) + 1;
+    }
+  }
+  type_section = (char *) calloc(1, len);
+  type_offset = (uint32_t *) type_section;
+  for (len = NUM_TYPES * sizeof (*type_offset), i = 0; i < NUM_TYPES; i++) {
+    if (types[i]) {
+      type_offset[i] = len;
+      strcpy(type_section + len, types[i]);
+      len += strlen(types[i]) + 1;
+    } else {
+      type_offset[i] = TYPE_NULL;
+    }
+  }
+
+  base[table_pokemon_moves] = pokemon_moves;
+  base[table_pokemon] = Pokemon;
+  base[table_moves] = moves;
+  base[table_experience] = experience;
+  base[table_pokemon_stats] = pokemon_stats;
+  base[table_stats] = stats;
+  base[table_pokemon_types] = pokemon_types;
+  base[table_species] = species;
+  base[table_types] = type_section;
+  base[table_learnset_offset] = learnset_offset;
+  base[table_learnset] = learnset;
+  base[table_strings] = db_strings;
+
+  for (offset = sizeof (h), i = 0; i < num_tables; i++) {
+    h.section[i].elem_size = db_layout[i].elem_size;
+    h.section[i].count = ((i == table_learnset) ? learnset_offset[NUM_SPECIES] :
+                          (i == table_strings)  ? db_strings_size()            :
+                          db_layout[i].count);
+    h.section[i].offset = offset = db_align(offset);
+    h.section[i].size = ((i == table_types) ?
+                         len                :
+                         ((uint64_t) h.section[i].elem_size *
+                          h.section[i].count));
+    h.section[i].checksum = db_hash(FNV_OFFSET, base[i], h.section[i].size);
+    offset += h.section[i].size;
+  }
+  h.payload_size = offset - sizeof (h);
+
+  /* Write to a private temporary and rename it over the old image, so *
+   * that concurrently starting games never see a half-written image.  */
+  tmp = (char *) malloc(strlen(path) + 16);
+  sprintf(tmp, "%s.%d", path, (int) getpid());
+
+  /* Probably the first run with the system-wide CSVs. */
+  if ((dir = db_home_path(DB_IMAGE_DIR))) {
+    mkdir(dir, 0755);
+    free(dir);
+  }
+
+  if (!(f = fopen(tmp, "wb"))) {
+    free(type_section);
+    free(tmp);
+    free(path);
+    return 1;
+  }
+
+  err = fwrite(&h, sizeof (h), 1, f) != 1;
+
+  for (i = 0; !err && i < num_tables; i++) {
+    err = (db_write_padding(f, h.section[i].offset) ||
+           db_write(f, base[i], h.section[i].size));
+  }
+
+  err = fclose(f) || err;
+  err = err || rename(tmp, path);
+
+  if (err) {
+    unlink(tmp);
+  }
+
+  free(type_section);
+  free(tmp);
+  free(path);
+
+  return err;
+}
@@ -0,0 +1,17 @@
+#ifndef DB_IMAGE_H
+# define DB_IMAGE_H
+
+# include "db_parse.h"
+
+/* The parsed pokedex tables are cached in a binary image so that we only *
+ * have to tokenize the CSVs when they change.  prefix is the CSV         *
+ * directory found by db_parse(), and the ints are 0 on success.          *
+ *                                                                        *
+ * db_image_open() maps the image and checks that it is current without  *
+ * touching any table; db_image_table() then checks and returns a single  *
+ * table and its size in bytes, or NULL if it is damaged.                 */
+int db_image_open(const char *prefix);
+const void *db_image_table(db_table t, uint64_t *size);
+int db_image_save(const char *prefix);
+
+#endif
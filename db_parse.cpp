@@ -2,14 +2,27 @@
 #include <cstring>
 #include <cstdlib>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <climits>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "db_parse.h"
+#include "db_image.h"
+#include "csv.h"
+#include "bench.h"
+#include "db_strings.h"
 
 static char *next_token(char *start, char delim)
 {
   int i;
-  static char *s;
+  static thread_local char *s;
 
   if (start) {
     s = start;
@@ -33,7 +46,10 @@ static char *next_token(char *start, char delim)
  *                                                                         *
  * Needs an internal array because arguments are processed before the      *
  * function call, so if we returned the same pointer over and over again,  *
- * we'd print a bunch of whatever the final value processed was.           */
+ * we'd print a bunch of whatever the final value processed was.           *
+ *                                                                         *
+ * The export doesn't use it anymore; it's kept as the export benchmark's  *
+ * baseline.                                                               */
 static const char *i2s(int i)
 {
   static int next = 0;
@@ -52,28 +68,57 @@ static const char *i2s(int i)
   return s[next++];
 }
 
-pokemon_move_db pokemon_moves[528239];
-pokemon_db Pokemon[1093];
-char *types[19];
-move_db moves[845];
-pokemon_species_db species[899];
-experience_db experience[601];
-pokemon_stats_db pokemon_stats[6553];
-stats_db stats[9];
-pokemon_types_db pokemon_types[1676];
+#ifndef POKEDEX_EMBEDDED
 
-void db_parse(bool print)
+std::atomic<const void *> db_loaded[num_tables];
+
+db_view<pokemon_move_columns, table_pokemon_moves> pokemon_moves;
+db_view<pokemon_db, table_pokemon> Pokemon;
+db_view<const char *, table_types> types;
+db_view<move_db, table_moves> moves;
+db_view<pokemon_species_db, table_species> species;
+db_view<experience_db, table_experience> experience;
+db_view<pokemon_stats_db, table_pokemon_stats> pokemon_stats;
+db_view<stats_db, table_stats> stats;
+db_view<pokemon_types_db, table_pokemon_types> pokemon_types;
+db_view<uint32_t, table_learnset_offset> learnset_offset;
+db_view<levelup_move, table_learnset> learnset;
+db_view<char, table_strings> db_strings;
+
+/* The CSV directory, kept for tables that are loaded later. */
+static char *db_dir;
+static std::once_flag db_once[num_tables];
+/* Set once any table has had to come from the CSVs. */
+static std::atomic<bool> db_stale;
+static std::thread *db_prefetcher;
+static std::mutex db_saving;
+static uint32_t strings_size;
+
+static bool operator<(const levelup_move &f, const levelup_move &s)
+{
+  return ((f.level < s.level) || ((f.level == s.level) && f.move < s.move));
+}
+
+static bool move_less(const levelup_move &f, const levelup_move &s)
+{
+  return f.move < s.move;
+}
+
+static bool move_equal(const levelup_move &f, const levelup_move &s)
+{
+  return f.move == s.move;
+}
+
+#endif
+
+/* Returns a malloced copy of the directory holding the pokedex CSVs, *
+ * or NULL if none of the known locations exist.                      */
+static char *db_prefix()
 {
-  FILE *f;
-  char line[800];
-  int i;
-  char *tmp;
   struct stat buf;
   char *prefix;
-  int prefix_len;
-  int j;
-  int count;
-  
+  int i;
+
   i = (strlen(getenv("HOME")) +
        strlen("/.poke327/pokedex/pokedex/data/csv/") + 1);
   prefix = (char *) malloc(i);
@@ -92,24 +137,112 @@ void db_parse(bool print)
     // prefix is freed later, so be sure you malloc it
   }
 
-  //No error checking on file load from here on out.  Missing
-  //files are "user error".
-  prefix_len = strlen(prefix);
+  return prefix;
+}
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("pokemon.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon.csv");
-  
-  f = fopen(prefix, "r");
+/* Opens prefix/name.  No error checking on file load from here on out. *
+ * Missing files are "user error".                                     */
+static FILE *db_open_csv(const char *prefix, const char *name)
+{
+  char *path;
+  FILE *f;
+
+  path = (char *) malloc(strlen(prefix) + strlen(name) + 1);
+  strcpy(path, prefix);
+  strcat(path, name);
+
+  f = fopen(path, "r");
+
+  free(path);
+
+  return f;
+}
+
+#ifndef POKEDEX_EMBEDDED
+
+/* Reads one file's identifiers, the same way its table's parser reads *
+ * them, into the arena.                                               */
+static void db_intern_csv(db_arena *a, const char *prefix, const char *name,
+                          int field, int rows, int width)
+{
+  FILE *f;
+  char line[800];
+  char *tmp;
+  int i, j;
+
+  f = db_open_csv(prefix, name);
+
+  fgets(line, width, f);
+
+  for (i = 1; i < rows; i++) {
+    fgets(line, width, f);
+    for (tmp = next_token(line, ','), j = 0; j < field; j++) {
+      tmp = next_token(NULL, ',');
+    }
+    db_intern(a, tmp);
+  }
+
+  fclose(f);
+}
+
+static const char *db_parse_strings(const char *prefix)
+{
+  db_arena a;
+  char *s;
+
+  db_arena_init(&a);
+  db_intern_csv(&a, prefix, "pokemon.csv", 1, NUM_POKEMON, 80);
+  db_intern_csv(&a, prefix, "moves.csv", 1, NUM_MOVES, 800);
+  db_intern_csv(&a, prefix, "pokemon_species.csv", 1, NUM_SPECIES, 800);
+  db_intern_csv(&a, prefix, "stats.csv", 2, NUM_STATS, 800);
+
+  s = new char[a.bytes.size()];
+  memcpy(s, a.bytes.data(), a.bytes.size());
+  strings_size = a.bytes.size();
+
+  return s;
+}
+
+static std::unordered_map<std::string, uint32_t> string_offset;
+static std::once_flag string_offset_built;
+
+/* Where the parsers find the offsets of the names they read.  The    *
+ * arena may have come from the image, so index whatever is in it.    */
+static void db_index_strings()
+{
+  const char *s = db_strings;
+  uint32_t o, n;
+
+  for (n = db_strings_size(), o = 0; o < n; o += strlen(s + o) + 1) {
+    string_offset.emplace(s + o, o);
+  }
+}
+
+static uint32_t db_string_offset(const char *s)
+{
+  std::unordered_map<std::string, uint32_t>::iterator it;
+
+  std::call_once(string_offset_built, db_index_strings);
+
+  return (((it = string_offset.find(s)) == string_offset.end()) ?
+          0                                                     :
+          it->second);
+}
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+static void db_parse_pokemon(const char *prefix, pokemon_db *Pokemon)
+{
+  FILE *f;
+  char line[800];
+  int i;
+
+  f = db_open_csv(prefix, "pokemon.csv");
 
   fgets(line, 80, f);
   
   for (i = 1; i < 1093; i++) {
     fgets(line, 80, f);
     Pokemon[i].id = atoi(next_token(line, ','));
-    strncpy(Pokemon[i].identifier, next_token(NULL, ','), 30);
+    Pokemon[i].identifier = db_string_offset(next_token(NULL, ','));
     Pokemon[i].species_id = atoi(next_token(NULL, ','));
     Pokemon[i].height = atoi(next_token(NULL, ','));
     Pokemon[i].weight = atoi(next_token(NULL, ','));
@@ -119,38 +252,23 @@ void db_parse(bool print)
   }  
 
   fclose(f);
-  
-  if (print) {
-    f = fopen("pokemon.csv", "w");
-    for (i = 1; i < 1093; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(Pokemon[i].id),
-              Pokemon[i].identifier,
-              i2s(Pokemon[i].species_id),
-              i2s(Pokemon[i].height),
-              i2s(Pokemon[i].weight),
-              i2s(Pokemon[i].base_experience),
-              i2s(Pokemon[i].order),
-              i2s(Pokemon[i].is_default));
-    }
-    fclose(f);
-  }
-
+}
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("moves.csv") + 1);
-  strcpy(prefix + prefix_len, "moves.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_moves(const char *prefix, move_db *moves)
+{
+  FILE *f;
+  char line[800];
+  int i;
+  char *tmp;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "moves.csv");
 
   fgets(line, 800, f);
   
   for (i = 1; i < 845; i++) {
     fgets(line, 800, f);
     moves[i].id = atoi((tmp = next_token(line, ',')));
-    strcpy(moves[i].identifier, (tmp = next_token(NULL, ',')));
+    moves[i].identifier = db_string_offset((tmp = next_token(NULL, ',')));
     tmp = next_token(NULL, ',');
     moves[i].generation_id = *tmp ? atoi(tmp) : INT_MAX;
     tmp = next_token(NULL, ',');
@@ -180,88 +298,24 @@ void db_parse(bool print)
   }
 
   fclose(f);
-  
-  if (print) {
-    f = fopen("moves.csv", "w");
-    for (i = 1; i < 845; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(moves[i].id),
-              moves[i].identifier,
-              i2s(moves[i].generation_id),
-              i2s(moves[i].type_id),
-              i2s(moves[i].power),
-              i2s(moves[i].pp),
-              i2s(moves[i].accuracy),
-              i2s(moves[i].priority),
-              i2s(moves[i].target_id),
-              i2s(moves[i].damage_class_id),
-              i2s(moves[i].effect_id),
-              i2s(moves[i].effect_chance),
-              i2s(moves[i].contest_type_id),
-              i2s(moves[i].contest_effect_id),
-              i2s(moves[i].super_contest_effect_id));
-    }
-    fclose(f);
-  }
-
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_moves.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_moves.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 528239; i++) {
-    fgets(line, 800, f);
-    tmp = next_token(line, ',');
-    pokemon_moves[i].pokemon_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].version_group_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].move_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].pokemon_move_method_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].level = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].order = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
-  }
-
-  fclose(f);
-
-  if (print) {
-    f = fopen("pokemon_moves.csv", "w");
-    for (i = 1; i < 528239; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s\n",
-              i2s(pokemon_moves[i].pokemon_id),
-              i2s(pokemon_moves[i].version_group_id),
-              i2s(pokemon_moves[i].move_id),
-              i2s(pokemon_moves[i].pokemon_move_method_id),
-              i2s(pokemon_moves[i].level),
-              i2s(pokemon_moves[i].order));
-    }
-    fclose(f);
-  }
+}
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_species.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_species.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_species(const char *prefix, pokemon_species_db *species)
+{
+  const pokemon_stats_db *ps;
+  FILE *f;
+  char line[800];
+  int i, j;
+  char *tmp;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "pokemon_species.csv");
 
   fgets(line, 800, f);
   
   for (i = 1; i < 899; i++) {
     fgets(line, 800, f);
     species[i].id = atoi((tmp = next_token(line, ',')));
-    strcpy(species[i].identifier, (tmp = next_token(NULL, ',')));
+    species[i].identifier = db_string_offset((tmp = next_token(NULL, ',')));
     tmp = next_token(NULL, ',');
     species[i].generation_id = *tmp ? atoi(tmp) : INT_MAX;
     tmp = next_token(NULL, ',');
@@ -302,43 +356,22 @@ void db_parse(bool print)
 
   fclose(f);
 
-  if (print) {
-    f = fopen("pokemon_species.csv", "w");
-    for (i = 1; i < 899; i++) {
-      fprintf(f,
-              "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(species[i].id),
-              species[i].identifier,
-              i2s(species[i].generation_id),
-              i2s(species[i].evolves_from_species_id),
-              i2s(species[i].evolution_chain_id),
-              i2s(species[i].color_id),
-              i2s(species[i].shape_id),
-              i2s(species[i].habitat_id),
-              i2s(species[i].gender_rate),
-              i2s(species[i].capture_rate),
-              i2s(species[i].base_happiness),
-              i2s(species[i].is_baby),
-              i2s(species[i].hatch_counter),
-              i2s(species[i].has_gender_differences),
-              i2s(species[i].growth_rate_id),
-              i2s(species[i].forms_switchable),
-              i2s(species[i].is_legendary),
-              i2s(species[i].is_mythical),
-              i2s(species[i].order),
-              i2s(species[i].conquest_order));
+  ps = pokemon_stats;
+  for (i = 1; i < NUM_SPECIES; i++) {
+    for (j = 0; j < 6; j++) {
+      species[i].base_stat[j] = ps[i * 6 - 5 + j].base_stat;
     }
-    fclose(f);
   }
+}
 
+static void db_parse_experience(const char *prefix, experience_db *experience)
+{
+  FILE *f;
+  char line[800];
+  int i;
+  char *tmp;
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("experience.csv") + 1);
-  strcpy(prefix + prefix_len, "experience.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "experience.csv");
 
   fgets(line, 800, f);
   
@@ -352,25 +385,17 @@ void db_parse(bool print)
   }
 
   fclose(f);
+}
 
-  if (print) {
-    f = fopen("experience.csv", "w");
-    for (i = 1; i < 601; i++) {
-      fprintf(f, "%s,%s,%s\n",
-              i2s(experience[i].growth_rate_id),
-              i2s(experience[i].level),
-              i2s(experience[i].experience));
-    }
-    fclose(f);
-  }
-
-  prefix = (char *) realloc(prefix, prefix_len + strlen("type_names.csv") + 1);
-  strcpy(prefix + prefix_len, "type_names.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_types(const char *prefix, const char *types[NUM_TYPES])
+{
+  FILE *f;
+  char line[800];
+  int i;
+  int j;
+  int count;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "type_names.csv");
 
   fgets(line, 800, f);
   
@@ -395,23 +420,17 @@ void db_parse(bool print)
   }
 
   fclose(f);
+}
 
-  if (print) {
-    f = fopen("type_names.csv", "w");
-    for (i = 1; i < 19; i++) {
-      fprintf(f, "%s\n", types[i]);
-    }
-    fclose(f);
-  }
-
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_stats.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_stats.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_pokemon_stats(const char *prefix,
+                                   pokemon_stats_db *pokemon_stats)
+{
+  FILE *f;
+  char line[800];
+  int i;
+  char *tmp;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "pokemon_stats.csv");
 
   fgets(line, 800, f);
   
@@ -427,26 +446,16 @@ void db_parse(bool print)
   }
 
   fclose(f);
+}
 
-  if (print) {
-    f = fopen("pokemon_stats.csv", "w");
-    for (i = 1; i < 6553; i++) {
-      fprintf(f, "%s,%s,%s,%s\n",
-              i2s(pokemon_stats[i].pokemon_id),
-              i2s(pokemon_stats[i].stat_id),
-              i2s(pokemon_stats[i].base_stat),
-              i2s(pokemon_stats[i].effort));
-    }
-    fclose(f);
-  }
-  
-  prefix = (char *) realloc(prefix, prefix_len + strlen("stats.csv") + 1);
-  strcpy(prefix + prefix_len, "stats.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_stats(const char *prefix, stats_db *stats)
+{
+  FILE *f;
+  char line[800];
+  int i;
+  char *tmp;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "stats.csv");
 
   fgets(line, 800, f);
   
@@ -455,7 +464,7 @@ void db_parse(bool print)
     stats[i].id = atoi((tmp = next_token(line, ',')));
     tmp = next_token(NULL, ',');
     stats[i].damage_class_id = *tmp ? atoi(tmp) : INT_MAX;
-    strcpy(stats[i].identifier, (tmp = next_token(NULL, ',')));
+    stats[i].identifier = db_string_offset((tmp = next_token(NULL, ',')));
     tmp = next_token(NULL, ',');
     stats[i].is_battle_only =  *tmp ? atoi(tmp) : INT_MAX;
     tmp = next_token(NULL, ',');
@@ -463,28 +472,17 @@ void db_parse(bool print)
   }
 
   fclose(f);
-  
-  if (print) {
-    f = fopen("stats.csv", "w");
-    for (i = 1; i < 9; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s\n",
-              i2s(stats[i].id),
-              i2s(stats[i].damage_class_id),
-              stats[i].identifier,
-              i2s(stats[i].is_battle_only),
-              i2s(stats[i].game_index));
-    }
-    fclose(f);
-  }
+}
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_types.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_types.csv");
-  
-  f = fopen(prefix, "r");
+static void db_parse_pokemon_types(const char *prefix,
+                                   pokemon_types_db *pokemon_types)
+{
+  FILE *f;
+  char line[800];
+  int i;
+  char *tmp;
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  f = db_open_csv(prefix, "pokemon_types.csv");
 
   fgets(line, 800, f);
   
@@ -498,18 +496,1014 @@ void db_parse(bool print)
   }
 
   fclose(f);
-  
+}
+
+#endif
+
+/* pokemon_moves.csv is by far the largest file, so it is read whole and *
+ * split into line-aligned chunks.  The lines in each chunk are counted  *
+ * in parallel to find the row each chunk starts at, and then the chunks *
+ * are parsed in parallel.                                               */
+struct db_csv_chunk {
+  const char *start, *end;
+  int row;
+  int rows;
+};
+
+static char *db_read_csv(const char *prefix, const char *name, size_t *len)
+{
+  FILE *f;
+  char *buf;
+  struct stat s;
+
+  f = db_open_csv(prefix, name);
+
+  fstat(fileno(f), &s);
+  buf = (char *) malloc(s.st_size + CSV_PADDING);
+  *len = fread(buf, 1, s.st_size, f);
+  memset(buf + *len, 0, CSV_PADDING);
+
+  fclose(f);
+
+  return buf;
+}
+
+static void db_split_csv(const char *buf, size_t len,
+                         std::vector<db_csv_chunk> &chunks, int n)
+{
+  const char *start, *end, *stop;
+  db_csv_chunk c;
+  int i;
+
+  stop = buf + len;
+
+  // Skip the header
+  start = (const char *) memchr(buf, '\n', len);
+  start = start ? start + 1 : stop;
+
+  for (i = 0; i < n && start < stop; i++) {
+    end = start + (stop - start) / (n - i);
+    if (end < stop) {
+      end = (const char *) memchr(end, '\n', stop - end);
+      end = end ? end + 1 : stop;
+    }
+    c.start = start;
+    c.end = end;
+    c.row = c.rows = 0;
+    chunks.push_back(c);
+    start = end;
+  }
+}
+
+static void db_count_rows(db_csv_chunk *c)
+{
+  const char *s;
+
+  for (s = c->start; s < c->end; s++) {
+    c->rows += (*s == '\n');
+  }
+  if (c->end > c->start && c->end[-1] != '\n') {
+    c->rows++;
+  }
+}
+
+static void db_parse_pokemon_move(char *line, pokemon_move_db *m)
+{
+  char *tmp;
+
+  tmp = next_token(line, ',');
+  m->pokemon_id = *tmp ? atoi(tmp) : INT_MAX;
+  tmp = next_token(NULL, ',');
+  m->version_group_id = *tmp ? atoi(tmp) : INT_MAX;
+  tmp = next_token(NULL, ',');
+  m->move_id = *tmp ? atoi(tmp) : INT_MAX;
+  tmp = next_token(NULL, ',');
+  m->pokemon_move_method_id = *tmp ? atoi(tmp) : INT_MAX;
+  tmp = next_token(NULL, ',');
+  m->level = *tmp ? atoi(tmp) : INT_MAX;
+  tmp = next_token(NULL, ',');
+  m->order = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+}
+
+/* The fgets() and next_token() path that db_parse_pokemon_moves()    *
+ * replaced, kept as the reference for the tokenizer benchmark.  Each   *
+ * line is copied out as fgets() would have returned it, newline and    *
+ * all, so that empty last fields parse exactly as they used to.        */
+static void db_parse_pokemon_moves_lines(const db_csv_chunk *c,
+                                         pokemon_move_columns *pokemon_moves)
+{
+  char line[800];
+  const char *s, *e;
+  pokemon_move_db m;
+  size_t len;
+  int i;
+
+  for (s = c->start, i = c->row; s < c->end && i < NUM_POKEMON_MOVES; i++) {
+    e = (const char *) memchr(s, '\n', c->end - s);
+    e = e ? e + 1 : c->end;
+    len = std::min((size_t) (e - s), sizeof (line) - 1);
+    memcpy(line, s, len);
+    line[len] = '\0';
+    db_parse_pokemon_move(line, &m);
+    pokemon_moves->pokemon_id[i] = m.pokemon_id;
+    pokemon_moves->version_group_id[i] = m.version_group_id;
+    pokemon_moves->move_id[i] = m.move_id;
+    pokemon_moves->pokemon_move_method_id[i] = m.pokemon_move_method_id;
+    pokemon_moves->level[i] = m.level;
+    pokemon_moves->order[i] = m.order;
+    s = e;
+  }
+}
+
+static void db_parse_pokemon_moves(const db_csv_chunk *c,
+                                   pokemon_move_columns *pokemon_moves)
+{
+  csv_scanner_t s;
+  char d;
+  int i;
+
+  csv_init(&s, c->start, c->end);
+
+  for (i = c->row; !csv_done(&s) && i < NUM_POKEMON_MOVES; i++) {
+    pokemon_moves->pokemon_id[i] = csv_int(&s, &d);
+    pokemon_moves->version_group_id[i] = csv_int(&s, &d);
+    pokemon_moves->move_id[i] = csv_int(&s, &d);
+    pokemon_moves->pokemon_move_method_id[i] = csv_int(&s, &d);
+    pokemon_moves->level[i] = csv_int(&s, &d);
+    pokemon_moves->order[i] = csv_int(&s, &d);
+    csv_end_row(&s, d);
+  }
+}
+
+/* Runs every task, spread over as many threads as the machine has. */
+static void db_run_tasks(const std::vector<std::function<void()> > &tasks)
+{
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next(0);
+  unsigned i, n;
+
+  auto work = [&tasks, &next]() {
+    size_t t;
+
+    while ((t = next++) < tasks.size()) {
+      tasks[t]();
+    }
+  };
+
+  n = std::max(1u, std::thread::hardware_concurrency());
+  n = std::min((size_t) n, tasks.size());
+
+  for (i = 1; i < n; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+#ifndef POKEDEX_EMBEDDED
+
+static void db_parse_pokemon_moves_file(const char *prefix,
+                                        pokemon_move_columns *pokemon_moves)
+{
+  std::vector<std::function<void()> > tasks;
+  std::vector<db_csv_chunk> chunks;
+  char *buf;
+  size_t len;
+  unsigned i;
+  int row;
+
+  buf = db_read_csv(prefix, "pokemon_moves.csv", &len);
+  db_split_csv(buf, len, chunks,
+               4 * std::max(1u, std::thread::hardware_concurrency()));
+
+  for (i = 0; i < chunks.size(); i++) {
+    db_csv_chunk *c = &chunks[i];
+    tasks.push_back([c]() { db_count_rows(c); });
+  }
+  db_run_tasks(tasks);
+
+  for (i = 0, row = 1; i < chunks.size(); i++) {
+    chunks[i].row = row;
+    row += chunks[i].rows;
+  }
+
+  tasks.clear();
+  for (i = 0; i < chunks.size(); i++) {
+    const db_csv_chunk *c = &chunks[i];
+    tasks.push_back([=]() { db_parse_pokemon_moves(c, pokemon_moves); });
+  }
+  db_run_tasks(tasks);
+
+  free(buf);
+}
+
+/* Builds the per-species level-up move index from the level-up rows of *
+ * pokemon_moves, so that generating a pokemon never has to scan it.  A  *
+ * move that appears at several levels is kept at the level of its first *
+ * row, as pokemon generation always did.                                */
+static const uint32_t *built_learnset_offset;
+static const levelup_move *built_learnset;
+
+static void db_build_learnsets()
+{
+  std::vector<uint32_t> species_of;
+  std::vector<levelup_move> rows;
+  std::vector<uint32_t> row_species;
+  const pokemon_species_db *sp = species;
+  const pokemon_move_columns *pm = pokemon_moves;
+  pokemon_move_rows levelup = levelup_moves();
+  uint32_t *offset;
+  levelup_move *l;
+  uint32_t i, j, k, n;
+  int id;
+
+  for (i = 1; i < NUM_SPECIES; i++) {
+    if (sp[i].id >= 0) {
+      if ((uint32_t) sp[i].id >= species_of.size()) {
+        species_of.resize(sp[i].id + 1, 0);
+      }
+      species_of[sp[i].id] = i;
+    }
+  }
+
+  for (i = 0; i < levelup.count; i++) {
+    k = levelup.row[i];
+    id = pm->pokemon_id[k];
+    if (id >= 0 && (uint32_t) id < species_of.size() && (j = species_of[id])) {
+      rows.push_back({ pm->level[k], pm->move_id[k] });
+      row_species.push_back(j);
+    }
+  }
+
+  /* Counting sort by species keeps each species' rows in file order. */
+  offset = new uint32_t[NUM_SPECIES + 1]();
+  for (i = 0; i < rows.size(); i++) {
+    offset[row_species[i] + 1]++;
+  }
+  for (i = 0; i < NUM_SPECIES; i++) {
+    offset[i + 1] += offset[i];
+  }
+
+  l = new levelup_move[rows.size() + 1]();
+  std::vector<uint32_t> next(offset, offset + NUM_SPECIES);
+  for (i = 0; i < rows.size(); i++) {
+    l[next[row_species[i]]++] = rows[i];
+  }
+
+  /* Squeeze out duplicate moves in place and sort what's left.  The    *
+   * stable sort by move keeps the first row of each move at the front. */
+  for (n = 0, i = 0; i < NUM_SPECIES; i++) {
+    j = offset[i];
+    k = offset[i + 1];
+    std::stable_sort(l + j, l + k, move_less);
+    k = std::unique(l + j, l + k, move_equal) - l;
+    offset[i] = n;
+    n = std::copy(l + j, l + k, l + n) - l;
+    std::sort(l + offset[i], l + n);
+  }
+  offset[NUM_SPECIES] = n;
+
+  built_learnset_offset = offset;
+  built_learnset = l;
+}
+
+template <class T>
+static const T *db_parse_table(void (*parse)(const char *, T *), int n)
+{
+  T *t = new T[n]();
+
+  parse(db_dir, t);
+
+  return t;
+}
+
+static const void *db_load_csv(db_table t)
+{
+  static const char *csv_types[NUM_TYPES];
+  static std::once_flag built;
+
+  /* Index the strings before a parser starts tokenizing, since loading *
+   * them can mean reading CSVs with the same tokenizer.                 */
+  if (t == table_pokemon || t == table_moves ||
+      t == table_species || t == table_stats) {
+    std::call_once(string_offset_built, db_index_strings);
+  }
+
+  switch (t) {
+  case table_pokemon_moves:
+    return db_parse_table(db_parse_pokemon_moves_file, 1);
+  case table_pokemon:
+    return db_parse_table(db_parse_pokemon, NUM_POKEMON);
+  case table_moves:
+    return db_parse_table(db_parse_moves, NUM_MOVES);
+  case table_experience:
+    return db_parse_table(db_parse_experience, NUM_EXPERIENCE);
+  case table_pokemon_stats:
+    return db_parse_table(db_parse_pokemon_stats, NUM_POKEMON_STATS);
+  case table_stats:
+    return db_parse_table(db_parse_stats, NUM_STATS);
+  case table_pokemon_types:
+    return db_parse_table(db_parse_pokemon_types, NUM_POKEMON_TYPES);
+  case table_species:
+    return db_parse_table(db_parse_species, NUM_SPECIES);
+  case table_types:
+    db_parse_types(db_dir, csv_types);
+    return csv_types;
+  case table_learnset_offset:
+    std::call_once(built, db_build_learnsets);
+    return built_learnset_offset;
+  case table_learnset:
+    std::call_once(built, db_build_learnsets);
+    return built_learnset;
+  case table_strings:
+    return db_parse_strings(db_dir);
+  default:
+    return NULL;
+  }
+}
+
+static void db_save()
+{
+  std::lock_guard<std::mutex> lock(db_saving);
+
+  db_image_save(db_dir);
+}
+
+static void db_load_table(db_table t)
+{
+  const void *p;
+  uint64_t size;
+
+  if ((p = db_image_table(t, &size))) {
+    if (t == table_strings) {
+      strings_size = size;
+    }
+  } else {
+    p = db_load_csv(t);
+    /* A damaged section in a current image; parse it all again. */
+    if (!db_stale.exchange(true)) {
+      db_prefetch();
+    }
+  }
+
+  db_loaded[t].store(p, std::memory_order_release);
+}
+
+uint32_t db_strings_size()
+{
+  const char *s = db_strings;
+
+  return s ? strings_size : 0;
+}
+
+const void *db_load(db_table t)
+{
+  std::call_once(db_once[t], db_load_table, t);
+
+  return db_loaded[t].load(std::memory_order_acquire);
+}
+
+static void db_load_all()
+{
+  std::vector<std::function<void()> > tasks;
+  int t;
+
+  for (t = 0; t < num_tables; t++) {
+    tasks.push_back([t]() { db_load((db_table) t); });
+  }
+
+  db_run_tasks(tasks);
+}
+
+static void db_prefetch_join()
+{
+  db_prefetcher->join();
+}
+
+/* Rewrites the image, too, if anything had to come from the CSVs.  We *
+ * wait for it at exit so as not to leave a half-written temporary.    */
+void db_prefetch()
+{
+  static std::once_flag started;
+
+  std::call_once(started, []() {
+    db_prefetcher = new std::thread([]() {
+      db_load_all();
+      if (db_stale) {
+        db_save();
+      }
+    });
+    atexit(db_prefetch_join);
+  });
+}
+
+#else
+
+void db_prefetch()
+{
+}
+
+#endif
+
+static pokemon_move_rows levelup_all;
+static std::vector<uint32_t> levelup_group_offset;
+static const uint32_t *levelup_by_group;
+
+/* Level-up rows in file order, and again grouped by version group with a *
+ * counting sort, which keeps each group in file order.                  */
+static void db_build_levelup_moves()
+{
+  const int *method = pokemon_moves->pokemon_move_method_id;
+  const int *group = pokemon_moves->version_group_id;
+  std::vector<uint32_t> next;
+  uint32_t *rows, *by_group;
+  uint32_t i, n;
+
+  for (n = 0, i = 1; i < NUM_POKEMON_MOVES; i++) {
+    n += (method[i] == 1);
+  }
+
+  rows = new uint32_t[n + 1];
+  for (n = 0, i = 1; i < NUM_POKEMON_MOVES; i++) {
+    if (method[i] == 1) {
+      rows[n++] = i;
+      if (group[i] >= 0 && group[i] != INT_MAX) {
+        if ((uint32_t) group[i] + 2 > levelup_group_offset.size()) {
+          levelup_group_offset.resize(group[i] + 2, 0);
+        }
+        levelup_group_offset[group[i] + 1]++;
+      }
+    }
+  }
+  levelup_all.row = rows;
+  levelup_all.count = n;
+
+  for (i = 1; i < levelup_group_offset.size(); i++) {
+    levelup_group_offset[i] += levelup_group_offset[i - 1];
+  }
+
+  by_group = new uint32_t[levelup_group_offset.empty() ? 1 :
+                          levelup_group_offset.back() + 1];
+  next = levelup_group_offset;
+  for (i = 0; i < n; i++) {
+    if (group[rows[i]] >= 0 && group[rows[i]] != INT_MAX) {
+      by_group[next[group[rows[i]]]++] = rows[i];
+    }
+  }
+  levelup_by_group = by_group;
+}
+
+static std::once_flag levelup_built;
+
+pokemon_move_rows levelup_moves()
+{
+  std::call_once(levelup_built, db_build_levelup_moves);
+
+  return levelup_all;
+}
+
+pokemon_move_rows levelup_moves(int version_group)
+{
+  pokemon_move_rows r;
+
+  std::call_once(levelup_built, db_build_levelup_moves);
+
+  r.row = levelup_by_group;
+  r.count = 0;
+
+  if (version_group >= 0 &&
+      (uint32_t) version_group + 1 < levelup_group_offset.size()) {
+    r.row = levelup_by_group + levelup_group_offset[version_group];
+    r.count = (levelup_group_offset[version_group + 1] -
+               levelup_group_offset[version_group]);
+  }
+
+  return r;
+}
+
+static db_phash name_index[num_tables];
+static std::once_flag name_index_built[num_tables];
+
+static void db_index_names(db_table t)
+{
+  std::vector<const char *> name;
+  int i;
+
+  switch (t) {
+  case table_pokemon:
+    for (i = 0; i < NUM_POKEMON; i++) {
+      name.push_back(db_string(Pokemon[i].identifier));
+    }
+    break;
+  case table_moves:
+    for (i = 0; i < NUM_MOVES; i++) {
+      name.push_back(db_string(moves[i].identifier));
+    }
+    break;
+  case table_species:
+    for (i = 0; i < NUM_SPECIES; i++) {
+      name.push_back(db_string(species[i].identifier));
+    }
+    break;
+  case table_stats:
+    for (i = 0; i < NUM_STATS; i++) {
+      name.push_back(db_string(stats[i].identifier));
+    }
+    break;
+  default:
+    break;
+  }
+
+  db_phash_build(&name_index[t], name);
+}
+
+int db_lookup(db_table t, const char *identifier)
+{
+  std::call_once(name_index_built[t], db_index_names, t);
+
+  return db_phash_find(&name_index[t], identifier);
+}
+
+/* The export writes each table through one buffer, sized up front for  *
+ * the worst case, so there's no stdio and no allocation per field.  Big *
+ * tables are formatted in parts, in parallel, at fixed offsets in that  *
+ * buffer, and the parts are gathered by writev().                       */
+#define EXPORT_PART_ROWS 65536
+#define EXPORT_INT_WIDTH 12    /* "-2147483648," */
+
+static const char db_digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324"
+  "25262728293031323334353637383940414243444546474849"
+  "50515253545556575859606162636465666768697071727374"
+  "75767778798081828384858687888990919293949596979899";
+
+/* Appends i, or nothing if it's INT_MAX, followed by delim. */
+static inline char *db_put_int(char *p, int i, char delim)
+{
+  char digits[10], *d;
+  unsigned u;
+
+  if (i != INT_MAX) {
+    if (i < 0) {
+      *p++ = '-';
+      u = 0u - (unsigned) i;
+    } else {
+      u = i;
+    }
+
+    d = digits + sizeof (digits);
+    while (u >= 100) {
+      d -= 2;
+      memcpy(d, db_digit_pairs + 2 * (u % 100), 2);
+      u /= 100;
+    }
+    if (u >= 10) {
+      d -= 2;
+      memcpy(d, db_digit_pairs + 2 * u, 2);
+    } else {
+      *--d = '0' + u;
+    }
+
+    memcpy(p, d, digits + sizeof (digits) - d);
+    p += digits + sizeof (digits) - d;
+  }
+  *p++ = delim;
+
+  return p;
+}
+
+static inline char *db_put_str(char *p, const char *s, char delim)
+{
+  size_t len;
+
+  len = strlen(s);
+  memcpy(p, s, len);
+  p += len;
+  *p++ = delim;
+
+  return p;
+}
+
+static char *db_format_pokemon(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, Pokemon[i].id, ',');
+    p = db_put_str(p, db_string(Pokemon[i].identifier), ',');
+    p = db_put_int(p, Pokemon[i].species_id, ',');
+    p = db_put_int(p, Pokemon[i].height, ',');
+    p = db_put_int(p, Pokemon[i].weight, ',');
+    p = db_put_int(p, Pokemon[i].base_experience, ',');
+    p = db_put_int(p, Pokemon[i].order, ',');
+    p = db_put_int(p, Pokemon[i].is_default, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_moves(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, moves[i].id, ',');
+    p = db_put_str(p, db_string(moves[i].identifier), ',');
+    p = db_put_int(p, moves[i].generation_id, ',');
+    p = db_put_int(p, moves[i].type_id, ',');
+    p = db_put_int(p, moves[i].power, ',');
+    p = db_put_int(p, moves[i].pp, ',');
+    p = db_put_int(p, moves[i].accuracy, ',');
+    p = db_put_int(p, moves[i].priority, ',');
+    p = db_put_int(p, moves[i].target_id, ',');
+    p = db_put_int(p, moves[i].damage_class_id, ',');
+    p = db_put_int(p, moves[i].effect_id, ',');
+    p = db_put_int(p, moves[i].effect_chance, ',');
+    p = db_put_int(p, moves[i].contest_type_id, ',');
+    p = db_put_int(p, moves[i].contest_effect_id, ',');
+    p = db_put_int(p, moves[i].super_contest_effect_id, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_pokemon_moves(char *p, int first, int last)
+{
+  const pokemon_move_columns *m = pokemon_moves;
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, m->pokemon_id[i], ',');
+    p = db_put_int(p, m->version_group_id[i], ',');
+    p = db_put_int(p, m->move_id[i], ',');
+    p = db_put_int(p, m->pokemon_move_method_id[i], ',');
+    p = db_put_int(p, m->level[i], ',');
+    p = db_put_int(p, m->order[i], '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_species(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, species[i].id, ',');
+    p = db_put_str(p, db_string(species[i].identifier), ',');
+    p = db_put_int(p, species[i].generation_id, ',');
+    p = db_put_int(p, species[i].evolves_from_species_id, ',');
+    p = db_put_int(p, species[i].evolution_chain_id, ',');
+    p = db_put_int(p, species[i].color_id, ',');
+    p = db_put_int(p, species[i].shape_id, ',');
+    p = db_put_int(p, species[i].habitat_id, ',');
+    p = db_put_int(p, species[i].gender_rate, ',');
+    p = db_put_int(p, species[i].capture_rate, ',');
+    p = db_put_int(p, species[i].base_happiness, ',');
+    p = db_put_int(p, species[i].is_baby, ',');
+    p = db_put_int(p, species[i].hatch_counter, ',');
+    p = db_put_int(p, species[i].has_gender_differences, ',');
+    p = db_put_int(p, species[i].growth_rate_id, ',');
+    p = db_put_int(p, species[i].forms_switchable, ',');
+    p = db_put_int(p, species[i].is_legendary, ',');
+    p = db_put_int(p, species[i].is_mythical, ',');
+    p = db_put_int(p, species[i].order, ',');
+    p = db_put_int(p, species[i].conquest_order, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_experience(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, experience[i].growth_rate_id, ',');
+    p = db_put_int(p, experience[i].level, ',');
+    p = db_put_int(p, experience[i].experience, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_types(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_str(p, types[i], '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_pokemon_stats(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, pokemon_stats[i].pokemon_id, ',');
+    p = db_put_int(p, pokemon_stats[i].stat_id, ',');
+    p = db_put_int(p, pokemon_stats[i].base_stat, ',');
+    p = db_put_int(p, pokemon_stats[i].effort, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_stats(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, stats[i].id, ',');
+    p = db_put_int(p, stats[i].damage_class_id, ',');
+    p = db_put_str(p, db_string(stats[i].identifier), ',');
+    p = db_put_int(p, stats[i].is_battle_only, ',');
+    p = db_put_int(p, stats[i].game_index, '\n');
+  }
+
+  return p;
+}
+
+static char *db_format_pokemon_types(char *p, int first, int last)
+{
+  int i;
+
+  for (i = first; i < last; i++) {
+    p = db_put_int(p, pokemon_types[i].pokemon_id, ',');
+    p = db_put_int(p, pokemon_types[i].type_id, ',');
+    p = db_put_int(p, pokemon_types[i].slot, '\n');
+  }
+
+  return p;
+}
+
+typedef struct db_export_table {
+  const char *name;
+  int rows;           /* Including the unused row 0 */
+  int ints;           /* Integer fields per row     */
+  size_t strings;     /* Most bytes of string fields a part can hold */
+  char *(*format)(char *p, int first, int last);
+  char *buf;
+  std::vector<struct iovec> parts;
+} db_export_table_t;
+
+/* writev() may stop short, or take fewer than all of the parts at once. */
+static void db_write_parts(const char *name, struct iovec *iov, int n)
+{
+  ssize_t w;
+  int fd;
+
+  if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+    perror(name);
+
+    return;
+  }
+
+  while (n && (w = writev(fd, iov, std::min(n, IOV_MAX))) > 0) {
+    while (n && (size_t) w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n) {
+      iov->iov_base = (char *) iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  if (n) {
+    perror(name);
+  }
+
+  close(fd);
+}
+
+static void db_export()
+{
+  std::vector<std::function<void()> > tasks;
+  size_t type_names, part_size;
+  unsigned i, j;
+  int first;
+
+  for (type_names = 0, i = 1; i < NUM_TYPES; i++) {
+    type_names += strlen(types[i]);
+  }
+
+  db_export_table_t tables[] = {
+    { "pokemon.csv", NUM_POKEMON, 7, db_strings_size(),
+      db_format_pokemon },
+    { "moves.csv", NUM_MOVES, 14, db_strings_size(),
+      db_format_moves },
+    { "pokemon_moves.csv", NUM_POKEMON_MOVES, 6, 0,
+      db_format_pokemon_moves },
+    { "pokemon_species.csv", NUM_SPECIES, 19, db_strings_size(),
+      db_format_species },
+    { "experience.csv", NUM_EXPERIENCE, 3, 0,
+      db_format_experience },
+    { "type_names.csv", NUM_TYPES, 0, type_names,
+      db_format_types },
+    { "pokemon_stats.csv", NUM_POKEMON_STATS, 4, 0,
+      db_format_pokemon_stats },
+    { "stats.csv", NUM_STATS, 4, db_strings_size(),
+      db_format_stats },
+    { "pokemon_types.csv", NUM_POKEMON_TYPES, 3, 0,
+      db_format_pokemon_types },
+  };
+  const unsigned num_tables = sizeof (tables) / sizeof (tables[0]);
+
+  for (i = 0; i < num_tables; i++) {
+    db_export_table_t *t = &tables[i];
+
+    part_size = ((size_t) std::min(t->rows, EXPORT_PART_ROWS) *
+                 EXPORT_INT_WIDTH * (t->ints + 1) + t->strings);
+    t->parts.resize((t->rows - 2) / EXPORT_PART_ROWS + 1);
+    t->buf = (char *) malloc(part_size * t->parts.size());
+
+    for (j = 0, first = 1; j < t->parts.size(); j++) {
+      struct iovec *part = &t->parts[j];
+      int last = std::min(first + EXPORT_PART_ROWS, t->rows);
+
+      part->iov_base = t->buf + part_size * j;
+      tasks.push_back([=]() {
+        part->iov_len = (t->format((char *) part->iov_base, first, last) -
+                         (char *) part->iov_base);
+      });
+      first = last;
+    }
+  }
+
+  db_run_tasks(tasks);
+
+  for (i = 0; i < num_tables; i++) {
+    db_write_parts(tables[i].name, tables[i].parts.data(),
+                   tables[i].parts.size());
+    free(tables[i].buf);
+  }
+}
+
+#ifdef POKEDEX_EMBEDDED
+
+void db_parse(bool print)
+{
+  if (print) {
+    db_export();
+  }
+}
+
+#else
+
+void db_open(const char *dir)
+{
+  db_dir = dir ? strdup(dir) : NULL;
+
+  /* Without a current image everything gets parsed, sooner or later. */
+  if (db_image_open(db_dir)) {
+    db_stale = true;
+  }
+}
+
+void db_parse(bool print)
+{
+  char *prefix;
+
+  prefix = db_prefix();
+  db_open(prefix);
+  free(prefix);
+
   if (print) {
-    f = fopen("pokemon_types.csv", "w");
-    for (i = 1; i < 1676; i++) {
-      fprintf(f, "%s,%s,%s\n",
-              i2s(pokemon_types[i].pokemon_id),
-              i2s(pokemon_types[i].type_id),
-              i2s(pokemon_types[i].slot));
+    db_load_all();
+    if (db_stale) {
+      db_save();
     }
-    fclose(f);
+    db_export();
+  } else if (db_stale) {
+    /* Start on the tables now and save a new image when they're done. */
+    db_prefetch();
   }
+}
 
+#endif
+
+/* Parses pokemon_moves.csv on one thread with the old line-at-a-time *
+ * tokenizer and with the csv scanner, and checks that they agree.    */
+int db_bench_tokenizer(int reps)
+{
+  std::vector<db_csv_chunk> chunks;
+  pokemon_move_columns *lines, *scanned;
+  double t, best_lines, best_scanned;
+  char *prefix, *buf;
+  size_t len;
+  int i, same;
 
+  if (!(prefix = db_prefix())) {
+    fprintf(stderr, "No pokedex found.\n");
+
+    return -1;
+  }
+
+  buf = db_read_csv(prefix, "pokemon_moves.csv", &len);
   free(prefix);
+
+  db_split_csv(buf, len, chunks, 1);
+  db_count_rows(&chunks[0]);
+  chunks[0].row = 1;
+
+  lines = new pokemon_move_columns();
+  scanned = new pokemon_move_columns();
+
+  for (best_lines = best_scanned = 1e9, i = 0; i < reps; i++) {
+    t = bench_now();
+    db_parse_pokemon_moves_lines(&chunks[0], lines);
+    best_lines = std::min(best_lines, bench_now() - t);
+
+    t = bench_now();
+    db_parse_pokemon_moves(&chunks[0], scanned);
+    best_scanned = std::min(best_scanned, bench_now() - t);
+  }
+
+  same = !memcmp(lines, scanned, sizeof (*lines));
+
+  printf("pokemon_moves.csv: %zu bytes, %d rows, best of %d\n",
+         len, chunks[0].rows, reps);
+  printf("  next_token/atoi: %8.2f ms %8.1f MB/s\n",
+         best_lines * 1000.0, len / best_lines / 1e6);
+  printf("  csv scanner:     %8.2f ms %8.1f MB/s\n",
+         best_scanned * 1000.0, len / best_scanned / 1e6);
+  printf("  speedup %.2fx, tables %s\n",
+         best_lines / best_scanned, same ? "match" : "DIFFER");
+
+  delete lines;
+  delete scanned;
+  free(buf);
+
+  return !same;
+}
+
+/* Formats pokemon_moves into memory with sprintf() and i2s(), as the *
+ * export used to, and with the bulk writer, and checks that they     *
+ * agree.                                                              */
+int db_bench_export(int reps)
+{
+  double t, best_sprintf, best_bulk;
+  char *printed, *bulk, *p, *end;
+  size_t size;
+  int i, j, same;
+
+#ifndef POKEDEX_EMBEDDED
+  char *prefix;
+
+  if (!(prefix = db_prefix())) {
+    fprintf(stderr, "No pokedex found.\n");
+
+    return -1;
+  }
+  db_open(prefix);
+  free(prefix);
+#endif
+
+  size = (size_t) NUM_POKEMON_MOVES * EXPORT_INT_WIDTH * 7;
+  printed = (char *) malloc(size);
+  bulk = (char *) malloc(size);
+
+  /* Loads the table, so that neither side gets charged for it. */
+  db_format_pokemon_moves(bulk, 1, 2);
+
+  for (best_sprintf = best_bulk = 1e9, p = printed, end = bulk, i = 0;
+       i < reps; i++) {
+    t = bench_now();
+    for (p = printed, j = 1; j < NUM_POKEMON_MOVES; j++) {
+      p += sprintf(p, "%s,%s,%s,%s,%s,%s\n",
+                   i2s(pokemon_moves->pokemon_id[j]),
+                   i2s(pokemon_moves->version_group_id[j]),
+                   i2s(pokemon_moves->move_id[j]),
+                   i2s(pokemon_moves->pokemon_move_method_id[j]),
+                   i2s(pokemon_moves->level[j]),
+                   i2s(pokemon_moves->order[j]));
+    }
+    best_sprintf = std::min(best_sprintf, bench_now() - t);
+
+    t = bench_now();
+    end = db_format_pokemon_moves(bulk, 1, NUM_POKEMON_MOVES);
+    best_bulk = std::min(best_bulk, bench_now() - t);
+  }
+
+  same = (p - printed == end - bulk && !memcmp(printed, bulk, p - printed));
+
+  printf("pokemon_moves.csv: %zu bytes, %d rows, best of %d\n",
+         (size_t) (end - bulk), NUM_POKEMON_MOVES - 1, reps);
+  printf("  sprintf/i2s:     %8.2f ms %8.1f MB/s\n",
+         best_sprintf * 1000.0, (end - bulk) / best_sprintf / 1e6);
+  printf("  bulk writer:     %8.2f ms %8.1f MB/s\n",
+         best_bulk * 1000.0, (end - bulk) / best_bulk / 1e6);
+  printf("  speedup %.2fx, output %s\n",
+         best_sprintf / best_bulk, same ? "matches" : "DIFFERS");
+
+  free(printed);
+  free(bulk);
+
+  return !same;
 }
@@ -1,11 +1,23 @@
 #ifndef DB_PARSE_H
 # define DB_PARSE_H
 
-#include <vector>
+#include <stdint.h>
+#include <atomic>
 
+# define NUM_POKEMON_MOVES 528239
+# define NUM_POKEMON       1093
+# define NUM_TYPES         19
+# define NUM_MOVES         845
+# define NUM_SPECIES       899
+# define NUM_EXPERIENCE    601
+# define NUM_POKEMON_STATS 6553
+# define NUM_STATS         9
+# define NUM_POKEMON_TYPES 1676
+
+/* Identifiers are offsets into db_strings; see db_string() below. */
 struct pokemon_db {
   int id;
-  char identifier[30];
+  uint32_t identifier;
   int species_id;
   int height;
   int weight;
@@ -16,7 +28,7 @@ struct pokemon_db {
 
 struct move_db {
   int id;
-  char identifier[50];
+  uint32_t identifier;
   int generation_id;
   int type_id;
   int power;
@@ -41,17 +53,38 @@ struct pokemon_move_db {
   int order;
 };
 
+/* pokemon_moves is far bigger than everything else put together, and   *
+ * scans of it only ever want a column or two, so it is stored a column *
+ * at a time.  Row i is pokemon_moves->level[i] and so on.              */
+struct pokemon_move_columns {
+  int pokemon_id[NUM_POKEMON_MOVES];
+  int version_group_id[NUM_POKEMON_MOVES];
+  int move_id[NUM_POKEMON_MOVES];
+  int pokemon_move_method_id[NUM_POKEMON_MOVES];
+  int level[NUM_POKEMON_MOVES];
+  int order[NUM_POKEMON_MOVES];
+
+  pokemon_move_db row(int i) const
+  {
+    return { pokemon_id[i], version_group_id[i], move_id[i],
+             pokemon_move_method_id[i], level[i], order[i] };
+  }
+};
+
+/* Row numbers of pokemon_moves, ascending, picked out by some predicate. */
+struct pokemon_move_rows {
+  const uint32_t *row;
+  uint32_t count;
+};
+
 struct levelup_move {
   int level;
   int move;
 };
 
 struct pokemon_species_db {
-  pokemon_species_db() : levelup_moves() {}
-  ~pokemon_species_db() {}
-  
   int id;
-  char identifier[30];
+  uint32_t identifier;
   int generation_id;
   int evolves_from_species_id;
   int evolution_chain_id;
@@ -71,7 +104,7 @@ struct pokemon_species_db {
   int order;
   int conquest_order;
 
-  std::vector<levelup_move> levelup_moves;
+  // Filled in from pokemon_stats when the tables are built
   int base_stat[6];
 };
 
@@ -91,7 +124,7 @@ struct pokemon_stats_db {
 struct stats_db {
   int id;
   int damage_class_id;
-  char identifier[30];
+  uint32_t identifier;
   int is_battle_only;
   int game_index;
 };
@@ -102,16 +135,119 @@ struct pokemon_types_db {
   int slot;
 };
 
-extern pokemon_move_db pokemon_moves[528239];
-extern pokemon_db Pokemon[1093];
-extern char *types[19];
-extern move_db moves[845];
-extern pokemon_species_db species[899];
-extern experience_db experience[601];
-extern pokemon_stats_db pokemon_stats[6553];
-extern stats_db stats[9];
-extern pokemon_types_db pokemon_types[1676];
+/* Every table is loaded the first time it is used, from the pokedex image *
+ * if it is current (see db_image.cpp), otherwise by parsing its CSV.      *
+ * Most games never touch most of the pokedex, and so never pay for it.    *
+ * The order here is also the order of the sections in the image.         */
+enum db_table {
+  table_pokemon_moves,
+  table_pokemon,
+  table_moves,
+  table_experience,
+  table_pokemon_stats,
+  table_stats,
+  table_pokemon_types,
+  table_species,
+  table_types,
+  table_learnset_offset,
+  table_learnset,
+  table_strings,
+  num_tables
+};
+
+# ifdef POKEDEX_EMBEDDED
+
+/* Compiled into the binary from CSVs by mkpokedex (make EMBED=1), so *
+ * there is nothing to find or load, and lookups into these can be    *
+ * folded by the compiler.                                            */
+extern const pokemon_move_columns *const pokemon_moves;
+extern const pokemon_db Pokemon[NUM_POKEMON];
+extern const char *const types[NUM_TYPES];
+extern const move_db moves[NUM_MOVES];
+extern const pokemon_species_db species[NUM_SPECIES];
+extern const experience_db experience[NUM_EXPERIENCE];
+extern const pokemon_stats_db pokemon_stats[NUM_POKEMON_STATS];
+extern const stats_db stats[NUM_STATS];
+extern const pokemon_types_db pokemon_types[NUM_POKEMON_TYPES];
+
+/* Level-up moves of species[i], deduplicated and sorted by level, are *
+ * learnset[learnset_offset[i]] up to learnset[learnset_offset[i + 1]]. */
+extern const uint32_t learnset_offset[NUM_SPECIES + 1];
+extern const levelup_move learnset[];
+
+extern const char db_strings[];
+
+# else
+
+extern std::atomic<const void *> db_loaded[num_tables];
+const void *db_load(db_table t);
+
+/* A read-only table that converts to a plain pointer, loading the table *
+ * first if nobody has yet.  Index it like the pointer it stands for;    *
+ * hot loops should convert once and hang on to the pointer.             */
+template <class T, db_table table>
+class db_view {
+ public:
+  operator const T *() const
+  {
+    const void *p = db_loaded[table].load(std::memory_order_acquire);
+
+    return (const T *) (p ? p : db_load(table));
+  }
+
+  const T *operator->() const
+  {
+    return *this;
+  }
+};
+
+extern db_view<pokemon_move_columns, table_pokemon_moves> pokemon_moves;
+extern db_view<pokemon_db, table_pokemon> Pokemon;
+extern db_view<const char *, table_types> types;
+extern db_view<move_db, table_moves> moves;
+extern db_view<pokemon_species_db, table_species> species;
+extern db_view<experience_db, table_experience> experience;
+extern db_view<pokemon_stats_db, table_pokemon_stats> pokemon_stats;
+extern db_view<stats_db, table_stats> stats;
+extern db_view<pokemon_types_db, table_pokemon_types> pokemon_types;
+
+/* Level-up moves of species[i], deduplicated and sorted by level, are *
+ * learnset[learnset_offset[i]] up to learnset[learnset_offset[i + 1]]. */
+extern db_view<uint32_t, table_learnset_offset> learnset_offset;
+extern db_view<levelup_move, table_learnset> learnset;
+
+extern db_view<char, table_strings> db_strings;
+
+/* Uses the CSVs in dir, or the image built from them, without saving *
+ * a new image.  db_parse() does this with the directory it finds.    */
+void db_open(const char *dir);
+
+# endif
+
+/* Every identifier in the pokedex, interned. */
+uint32_t db_strings_size();
+
+static inline const char *db_string(uint32_t offset)
+{
+  return db_strings + offset;
+}
+
+/* Finds a row of Pokemon, moves, species or stats by identifier in O(1), *
+ * returning its index or -1 if there's no such name.                     */
+int db_lookup(db_table t, const char *identifier);
+
+/* Filtered views of pokemon_moves, built on first use from the two   *
+ * columns they test: the rows learned by level-up, and those rows in  *
+ * one version group.  Unknown version groups have no rows.            */
+pokemon_move_rows levelup_moves();
+pokemon_move_rows levelup_moves(int version_group);
 
+/* Finds the pokedex; with print, also loads all of it and writes every *
+ * table back out as CSV in the current directory.                      */
 void db_parse(bool print);
+/* Loads every table on a background thread. */
+void db_prefetch();
+int db_bench_tokenizer(int reps);
+int db_bench_export(int reps);
 
 #endif
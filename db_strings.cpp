@@ -0,0 +1,136 @@
+#include <cstring>
+#include <algorithm>
+
+#include "db_strings.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+/* Names per bucket.  Bigger buckets make for a smaller seed table but *
+ * a longer search for seeds.                                          */
+#define PHASH_BUCKET_SIZE 4
+#define PHASH_MAX_SEED    (1U << 20)
+
+void db_arena_init(db_arena *a)
+{
+  a->bytes.assign(1, '\0');
+  a->offset.clear();
+  a->offset.emplace("", 0);
+}
+
+uint32_t db_intern(db_arena *a, const char *s)
+{
+  std::unordered_map<std::string, uint32_t>::iterator it;
+  uint32_t o;
+
+  if ((it = a->offset.find(s)) != a->offset.end()) {
+    return it->second;
+  }
+
+  o = a->bytes.size();
+  a->bytes.insert(a->bytes.end(), s, s + strlen(s) + 1);
+  a->offset.emplace(s, o);
+
+  return o;
+}
+
+/* FNV-1a over the name with the seed folded in first, then a final *
+ * mix so that the low bits, which pick the slot, depend on them all. */
+static uint32_t phash(const char *s, uint32_t seed)
+{
+  uint64_t h;
+
+  for (h = (FNV_OFFSET ^ seed) * FNV_PRIME; *s; s++) {
+    h = (h ^ (unsigned char) *s) * FNV_PRIME;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (uint32_t) h;
+}
+
+static int phash_try(db_phash *h, const std::vector<int32_t> &keys,
+                     uint32_t num_slots)
+{
+  std::vector<std::vector<int32_t> > bucket;
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> used;
+  uint32_t b, i, seed, s;
+
+  bucket.resize(keys.size() / PHASH_BUCKET_SIZE + 1);
+  for (i = 0; i < keys.size(); i++) {
+    bucket[phash(h->name[keys[i]], 0) % bucket.size()].push_back(keys[i]);
+  }
+
+  /* Place the biggest buckets while there's still plenty of room. */
+  for (b = 0; b < bucket.size(); b++) {
+    order.push_back(b);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&bucket](uint32_t x, uint32_t y) {
+                     return bucket[x].size() > bucket[y].size();
+                   });
+
+  h->seed.assign(bucket.size(), 0);
+  h->slot.assign(num_slots, -1);
+
+  for (b = 0; b < order.size() && !bucket[order[b]].empty(); b++) {
+    for (seed = 1; seed < PHASH_MAX_SEED; seed++) {
+      used.clear();
+      for (i = 0; i < bucket[order[b]].size(); i++) {
+        s = phash(h->name[bucket[order[b]][i]], seed) % num_slots;
+        if (h->slot[s] >= 0 ||
+            std::find(used.begin(), used.end(), s) != used.end()) {
+          break;
+        }
+        used.push_back(s);
+      }
+      if (i == bucket[order[b]].size()) {
+        break;
+      }
+    }
+    if (seed == PHASH_MAX_SEED) {
+      return 1;
+    }
+    h->seed[order[b]] = seed;
+    for (i = 0; i < used.size(); i++) {
+      h->slot[used[i]] = bucket[order[b]][i];
+    }
+  }
+
+  return 0;
+}
+
+void db_phash_build(db_phash *h, const std::vector<const char *> &name)
+{
+  std::unordered_map<std::string, int32_t> seen;
+  std::vector<int32_t> keys;
+  uint32_t i, n;
+
+  h->name = name;
+
+  for (i = 0; i < name.size(); i++) {
+    if (name[i] && *name[i] && seen.emplace(name[i], i).second) {
+      keys.push_back(i);
+    }
+  }
+
+  /* A minimal table nearly always works; if not, loosen it a little. */
+  for (n = keys.size() ? keys.size() : 1; phash_try(h, keys, n); n += n / 8 + 1)
+    ;
+}
+
+int db_phash_find(const db_phash *h, const char *name)
+{
+  int32_t row;
+
+  if (h->seed.empty()) {
+    return -1;
+  }
+
+  row = h->slot[phash(name, h->seed[phash(name, 0) % h->seed.size()]) %
+                h->slot.size()];
+
+  return (row >= 0 && !strcmp(h->name[row], name)) ? row : -1;
+}
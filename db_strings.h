@@ -0,0 +1,34 @@
+#ifndef DB_STRINGS_H
+# define DB_STRINGS_H
+
+# include <stdint.h>
+# include <string>
+# include <vector>
+# include <unordered_map>
+
+/* Identifiers live in one arena of interned, NUL-terminated strings, *
+ * and the tables hold 32-bit offsets into it.  Offset 0 is always the *
+ * empty string, so a zeroed row has an empty name.                    */
+struct db_arena {
+  std::vector<char> bytes;
+  std::unordered_map<std::string, uint32_t> offset;
+};
+
+void db_arena_init(db_arena *a);
+uint32_t db_intern(db_arena *a, const char *s);
+
+/* A minimal perfect hash from names to row numbers, by hash and       *
+ * displace: every bucket of names gets the first seed that sends all  *
+ * of them to free slots, so a lookup is two hashes and one strcmp().  */
+struct db_phash {
+  std::vector<uint32_t> seed;
+  std::vector<int32_t> slot;
+  std::vector<const char *> name;
+};
+
+/* name[i] is the name of row i; empty names are left out, and only the *
+ * first row with any given name is kept.                               */
+void db_phash_build(db_phash *h, const std::vector<const char *> &name);
+int db_phash_find(const db_phash *h, const char *name);
+
+#endif
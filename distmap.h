@@ -0,0 +1,281 @@
+#ifndef DISTMAP_H
+# define DISTMAP_H
+
+# include <limits.h>
+# include <assert.h>
+# include <stdint.h>
+# include <string.h>
+# include <algorithm>
+
+# include "poke327.h"
+
+/* Distance maps: for every cell, the cheapest cost for a character of  *
+ * type ctype to walk between it and source, paying the move_cost of    *
+ * each cell it leaves.  Cells on the border, cells ctype can't enter,  *
+ * and cells source can't be reached from are INT_MAX.                  *
+ *                                                                      *
+ * Every move costs at most 50, so a Dijkstra over a map only ever has  *
+ * keys in [d, d + 50] queued while it settles distance d.  That makes   *
+ * a ring of buckets indexed by distance a priority queue (Dial's        *
+ * algorithm): settling walks the ring once, and queued cells are linked *
+ * through arrays indexed by cell, so nothing is allocated.  A cell's    *
+ * key only ever decreases, so moving it means unlinking it from one     *
+ * bucket and linking it into another.                                   *
+ *                                                                      *
+ * The character type and the neighbourhood are template parameters, so *
+ * each instantiation reads a fixed row of move_cost and relaxes a fixed *
+ * list of neighbours, with the loop over them unrolled.                 */
+# define DIST_BUCKETS 64
+# define DIST_NONE    0xffff
+
+/* Neighbourhoods are offsets between cells of a map stored row by row. */
+struct moore_neighborhood {
+  static constexpr int size = 8;
+  static constexpr int offset[size] = {
+    -MAP_X - 1, -MAP_X, -MAP_X + 1,
+    -1,                 1,
+    MAP_X - 1,  MAP_X,  MAP_X + 1,
+  };
+};
+
+struct von_neumann_neighborhood {
+  static constexpr int size = 4;
+  static constexpr int offset[size] = { -MAP_X, -1, 1, MAP_X };
+};
+
+template <character_type_t ctype, class neighborhood = moore_neighborhood>
+void dist_map(const map_t *m, const pair_t source, int dist[MAP_Y][MAP_X])
+{
+  uint16_t head[DIST_BUCKETS];
+  uint16_t next[MAP_Y * MAP_X], prev[MAP_Y * MAP_X];
+  uint8_t open[MAP_Y * MAP_X];
+  int *d = &dist[0][0];
+  uint32_t x, y, i, n, queued;
+  int32_t cost, key;
+  int settle, j;
+
+  for (y = 0; y < MAP_Y; y++) {
+    for (x = 0; x < MAP_X; x++) {
+      dist[y][x] = INT_MAX;
+      open[y * MAP_X + x] = (y && x && y < MAP_Y - 1 && x < MAP_X - 1 &&
+                             move_cost[ctype][m->map[y][x]] != INT_MAX);
+    }
+  }
+  for (i = 0; i < DIST_BUCKETS; i++) {
+    head[i] = DIST_NONE;
+  }
+
+  i = source[dim_y] * MAP_X + source[dim_x];
+  d[i] = 0;
+  if (!open[i]) {
+    return;
+  }
+  next[i] = prev[i] = DIST_NONE;
+  head[0] = i;
+  queued = 1;
+
+  for (settle = 0; queued; settle++) {
+    while ((i = head[settle & (DIST_BUCKETS - 1)]) != DIST_NONE) {
+      head[settle & (DIST_BUCKETS - 1)] = next[i];
+      if (next[i] != DIST_NONE) {
+        prev[next[i]] = DIST_NONE;
+      }
+      queued--;
+      open[i] = 0;
+
+      cost = move_cost[ctype][m->map[i / MAP_X][i % MAP_X]];
+      assert(cost < DIST_BUCKETS);
+      key = settle + cost;
+
+#pragma GCC unroll 8
+      for (j = 0; j < neighborhood::size; j++) {
+        n = i + neighborhood::offset[j];
+        if (!open[n] || d[n] <= key) {
+          continue;
+        }
+
+        if (d[n] == INT_MAX) {
+          queued++;
+        } else if (prev[n] != DIST_NONE) {
+          next[prev[n]] = next[n];
+          if (next[n] != DIST_NONE) {
+            prev[next[n]] = prev[n];
+          }
+        } else {
+          head[d[n] & (DIST_BUCKETS - 1)] = next[n];
+          if (next[n] != DIST_NONE) {
+            prev[next[n]] = DIST_NONE;
+          }
+        }
+
+        d[n] = key;
+        prev[n] = DIST_NONE;
+        next[n] = head[key & (DIST_BUCKETS - 1)];
+        if (next[n] != DIST_NONE) {
+          prev[next[n]] = n;
+        }
+        head[key & (DIST_BUCKETS - 1)] = n;
+      }
+    }
+  }
+}
+
+/* Scratch space for dist_targets(), kept by the caller between        *
+ * queries.  Cells are only valid in the query whose stamp they carry,  *
+ * so a query never has to clear the whole map first.                   */
+typedef struct dist_scratch {
+  int32_t g[MAP_Y * MAP_X];
+  uint32_t stamp[MAP_Y * MAP_X];
+  uint16_t next[MAP_Y * MAP_X], prev[MAP_Y * MAP_X];
+  uint8_t closed[MAP_Y * MAP_X];
+  uint32_t query;
+} dist_scratch_t;
+
+/* Exact dist_map() distances of a few target cells, found by an A*     *
+ * search from source that stops once every target is settled.  The    *
+ * heuristic is the cheapest move times the Chebyshev distance to the   *
+ * targets' bounding box, which no step can shrink by more than one, so *
+ * it is consistent: settled distances are final, and f = g + h only    *
+ * ever grows by at most 50 + 10 per step, so the same ring of buckets  *
+ * serves as the queue.                                                 *
+ *                                                                      *
+ * Returns the number of cells expanded, or -1 if the search would have *
+ * to expand more than budget cells, in which case out is undefined.    */
+template <character_type_t ctype, class neighborhood = moore_neighborhood>
+int dist_targets(const map_t *m, const pair_t source, const pair_t *targets,
+                 int num_targets, int *out, dist_scratch_t *s, int budget)
+{
+  uint16_t head[DIST_BUCKETS];
+  uint32_t i, n;
+  int32_t cost, min_cost, key, h, dx, dy;
+  int lo_x, hi_x, lo_y, hi_y, x, y, t, j;
+  int settle, queued, waiting, expanded;
+
+# define DIST_OPEN(i) (((i) / MAP_X) && ((i) / MAP_X) < MAP_Y - 1 &&      \
+                       ((i) % MAP_X) && ((i) % MAP_X) < MAP_X - 1 &&      \
+                       move_cost[ctype][m->map[(i) / MAP_X][(i) % MAP_X]] \
+                       != INT_MAX)
+
+  if (!++s->query) {
+    memset(s->stamp, 0, sizeof (s->stamp));
+    s->query = 1;
+  }
+
+  for (min_cost = INT_MAX, j = 0; j < num_terrain_types; j++) {
+    min_cost = std::min(min_cost, move_cost[ctype][j]);
+  }
+
+  i = source[dim_y] * MAP_X + source[dim_x];
+  lo_x = hi_x = targets[0][dim_x];
+  lo_y = hi_y = targets[0][dim_y];
+  for (waiting = t = 0; t < num_targets; t++) {
+    n = targets[t][dim_y] * MAP_X + targets[t][dim_x];
+    out[t] = n == i ? 0 : INT_MAX;
+    if (n != i && DIST_OPEN(n) && DIST_OPEN(i)) {
+      waiting++;
+      lo_x = std::min(lo_x, (int) targets[t][dim_x]);
+      hi_x = std::max(hi_x, (int) targets[t][dim_x]);
+      lo_y = std::min(lo_y, (int) targets[t][dim_y]);
+      hi_y = std::max(hi_y, (int) targets[t][dim_y]);
+    }
+  }
+  if (!waiting) {
+    return 0;
+  }
+
+  for (j = 0; j < DIST_BUCKETS; j++) {
+    head[j] = DIST_NONE;
+  }
+
+# define DIST_H(i) (dx = (int) ((i) % MAP_X),                                 \
+                    dy = (int) ((i) / MAP_X),                                 \
+                    dx = dx < lo_x ? lo_x - dx : dx > hi_x ? dx - hi_x : 0,   \
+                    dy = dy < lo_y ? lo_y - dy : dy > hi_y ? dy - hi_y : 0,   \
+                    min_cost * std::max(dx, dy))
+
+  s->stamp[i] = s->query;
+  s->g[i] = 0;
+  s->closed[i] = 0;
+  s->next[i] = s->prev[i] = DIST_NONE;
+  settle = DIST_H(i);
+  head[settle & (DIST_BUCKETS - 1)] = i;
+  queued = 1;
+
+  for (expanded = 0; queued && waiting; settle++) {
+    while (waiting &&
+           (i = head[settle & (DIST_BUCKETS - 1)]) != DIST_NONE) {
+      head[settle & (DIST_BUCKETS - 1)] = s->next[i];
+      if (s->next[i] != DIST_NONE) {
+        s->prev[s->next[i]] = DIST_NONE;
+      }
+      queued--;
+      s->closed[i] = 1;
+
+      x = i % MAP_X;
+      y = i / MAP_X;
+      if (x >= lo_x && x <= hi_x && y >= lo_y && y <= hi_y) {
+        for (t = 0; t < num_targets; t++) {
+          if (targets[t][dim_x] == x && targets[t][dim_y] == y &&
+              out[t] == INT_MAX) {
+            out[t] = s->g[i];
+            waiting--;
+          }
+        }
+      }
+
+      if (++expanded > budget) {
+        return -1;
+      }
+
+      cost = move_cost[ctype][m->map[y][x]];
+      assert(cost < DIST_BUCKETS - 10);
+
+#pragma GCC unroll 8
+      for (j = 0; j < neighborhood::size; j++) {
+        n = i + neighborhood::offset[j];
+        if (s->stamp[n] != s->query) {
+          if (!DIST_OPEN(n)) {
+            continue;
+          }
+          s->stamp[n] = s->query;
+          s->closed[n] = 0;
+          s->g[n] = INT_MAX;
+        }
+        if (s->closed[n] || s->g[n] <= s->g[i] + cost) {
+          continue;
+        }
+
+        h = DIST_H(n);
+        if (s->g[n] == INT_MAX) {
+          queued++;
+        } else if (s->prev[n] != DIST_NONE) {
+          s->next[s->prev[n]] = s->next[n];
+          if (s->next[n] != DIST_NONE) {
+            s->prev[s->next[n]] = s->prev[n];
+          }
+        } else {
+          head[(s->g[n] + h) & (DIST_BUCKETS - 1)] = s->next[n];
+          if (s->next[n] != DIST_NONE) {
+            s->prev[s->next[n]] = DIST_NONE;
+          }
+        }
+
+        s->g[n] = s->g[i] + cost;
+        key = s->g[n] + h;
+        s->prev[n] = DIST_NONE;
+        s->next[n] = head[key & (DIST_BUCKETS - 1)];
+        if (s->next[n] != DIST_NONE) {
+          s->prev[s->next[n]] = n;
+        }
+        head[key & (DIST_BUCKETS - 1)] = n;
+      }
+    }
+  }
+
+# undef DIST_H
+# undef DIST_OPEN
+
+  return expanded;
+}
+
+#endif
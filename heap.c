@@ -2,17 +2,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "heap.h"
 
-struct heap_node {
-  heap_node_t *next;
-  heap_node_t *prev;
-  heap_node_t *parent;
-  heap_node_t *child;
-  void *datum;
-  uint32_t degree;
-  uint32_t mark;
+#define HEAP_MIN_SLAB      32
+#define HEAP_RADIX_BUCKETS 65
+#define HEAP_STATS_SITES   16
+
+#ifdef HEAP_STATS
+# define HEAP_STAT(s) s
+# define HEAP_STAT_MAX(m, v) heap_stats_max(&(m), (v))
+# define heap_stats_load(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+#else
+# define HEAP_STAT(s)
+#endif
+
+struct heap_slab {
+  struct heap_slab *next;
+  heap_node_t nodes[];
 };
 
 #define swap(a, b) ({    \
@@ -91,68 +99,105 @@ void print_heap_node_list(heap_node_t *n)
   printf("\n");
 }
 
-void heap_init(heap_t *h,
-               int32_t (*compare)(const void *key, const void *with),
-               void (*datum_delete)(void *))
+void heap_init_backend(heap_t *h, heap_backend_t backend,
+                       int32_t (*compare)(const void *key, const void *with),
+                       uint64_t (*key)(const void *v),
+                       void (*datum_delete)(void *))
 {
   h->min = NULL;
   h->size = 0;
   h->compare = compare;
   h->datum_delete = datum_delete;
+  h->free_nodes = NULL;
+  h->slabs = NULL;
+  h->backend = backend;
+  h->key = key;
+  h->array = NULL;
+  h->capacity = 0;
+  h->last = 0;
+  heap_stats_site(h, "other");
+
+  if (backend == heap_radix) {
+    assert(key);
+    h->capacity = HEAP_RADIX_BUCKETS;
+    assert((h->array = calloc(h->capacity, sizeof (*h->array))));
+  }
+}
+
+void heap_init(heap_t *h,
+               int32_t (*compare)(const void *key, const void *with),
+               void (*datum_delete)(void *))
+{
+  heap_init_backend(h, heap_fibonacci, compare, NULL, datum_delete);
+}
+
+void heap_add_nodes(heap_t *h, heap_node_t *nodes, uint32_t n)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    nodes[i].next = h->free_nodes;
+    h->free_nodes = nodes + i;
+  }
+}
+
+static heap_node_t *heap_alloc_node(heap_t *h)
+{
+  struct heap_slab *s;
+  heap_node_t *n;
+
+  if (!h->free_nodes) {
+    /* Grows with the heap, so a heap of n nodes needs lg n slabs. */
+    assert((s = malloc(sizeof (*s) +
+                       (h->size < HEAP_MIN_SLAB ? HEAP_MIN_SLAB : h->size) *
+                       sizeof (s->nodes[0]))));
+    s->next = h->slabs;
+    h->slabs = s;
+    heap_add_nodes(h, s->nodes,
+                   h->size < HEAP_MIN_SLAB ? HEAP_MIN_SLAB : h->size);
+  }
+
+  n = h->free_nodes;
+  h->free_nodes = n->next;
+  memset(n, 0, sizeof (*n));
+
+  return n;
 }
 
-void heap_node_delete(heap_t *h, heap_node_t *hn)
+static void heap_free_node(heap_t *h, heap_node_t *n)
+{
+  n->next = h->free_nodes;
+  h->free_nodes = n;
+}
+
+static void fib_delete(heap_t *h, heap_node_t *hn)
 {
   heap_node_t *next;
 
   hn->prev->next = NULL;
   while (hn) {
     if (hn->child) {
-      heap_node_delete(h, hn->child);
+      fib_delete(h, hn->child);
     } 
     next = hn->next;
     if (h->datum_delete) {
       h->datum_delete(hn->datum);
     }
-    free(hn);
     hn = next;
   }
 }
 
-void heap_delete(heap_t *h)
-{
-  if (h->min) {
-    heap_node_delete(h, h->min);
-  }
-  h->min = NULL;
-  h->size = 0;
-  h->compare = NULL;
-  h->datum_delete = NULL;
-}
-
-heap_node_t *heap_insert(heap_t *h, void *v)
+static void fib_insert(heap_t *h, heap_node_t *n)
 {
-  heap_node_t *n;
-
-  assert((n = calloc(1, sizeof (*n))));
-  n->datum = v;
-
   if (h->min) {
     insert_heap_node_in_list(n, h->min);
   } else {
     n->next = n->prev = n;
   }
-  if (!h->min || (h->compare(v, h->min->datum) < 0)) {
+  if (!h->min || (h->compare(n->datum, h->min->datum) < 0)) {
     h->min = n;
   }
   h->size++;
-
-  return n;
-}
-
-void *heap_peek_min(heap_t *h)
-{
-  return h->min ? h->min->datum : NULL;
 }
 
 static void heap_link(heap_t *h, heap_node_t *node, heap_node_t *root)
@@ -181,8 +226,12 @@ static void heap_consolidate(heap_t *h)
 
   h->min->prev->next = NULL;
 
+  HEAP_STAT(heap_stats_add(h->stats->consolidations, 1));
+  HEAP_STAT(i = 0);
+
   for (x = n = h->min; n; x = n) {
     n = n->next;
+    HEAP_STAT(i++);
 
     while (a[x->degree]) {
       y = a[x->degree];
@@ -195,6 +244,8 @@ static void heap_consolidate(heap_t *h)
     a[x->degree] = x;
   }
 
+  HEAP_STAT(HEAP_STAT_MAX(h->stats->max_roots, i));
+
   for (h->min = NULL, i = 0; i < 64; i++) {
     if (a[i]) {
       if (h->min) {
@@ -210,7 +261,7 @@ static void heap_consolidate(heap_t *h)
   }
 }
 
-void *heap_remove_min(heap_t *h)
+static void *fib_remove_min(heap_t *h)
 {
   void *v;
   heap_node_t *n;
@@ -220,7 +271,7 @@ void *heap_remove_min(heap_t *h)
   if (h->min) {
     v = h->min->datum;
     if (h->size == 1) {
-      free(h->min);
+      heap_free_node(h, h->min);
       h->min = NULL;
     } else {
       if ((n = h->min->child)) {
@@ -234,7 +285,7 @@ void *heap_remove_min(heap_t *h)
       n = h->min;
       remove_heap_node_from_list(n);
       h->min = n->next;
-      free(n);
+      heap_free_node(h, n);
 
       heap_consolidate(h);
     }
@@ -245,9 +296,39 @@ void *heap_remove_min(heap_t *h)
   return v;
 }
 
+static heap_node_t *heap_join_free(heap_node_t *l1, heap_node_t *l2)
+{
+  heap_node_t *n;
+
+  if (!l1) {
+    return l2;
+  }
+  for (n = l1; n->next; n = n->next)
+    ;
+  n->next = l2;
+
+  return l1;
+}
+
+static struct heap_slab *heap_join_slabs(struct heap_slab *l1,
+                                         struct heap_slab *l2)
+{
+  struct heap_slab *s;
+
+  if (!l1) {
+    return l2;
+  }
+  for (s = l1; s->next; s = s->next)
+    ;
+  s->next = l2;
+
+  return l1;
+}
+
 int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
 {
-  if (h1->compare != h2->compare ||
+  if (h1->backend != heap_fibonacci || h2->backend != heap_fibonacci ||
+      h1->compare != h2->compare ||
       h1->datum_delete != h2->datum_delete) {
     return 1;
   }
@@ -268,6 +349,10 @@ int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
     splice_heap_node_lists(h1->min, h2->min);
   }
 
+  /* h now owns the nodes of both, wherever they came from. */
+  h->free_nodes = heap_join_free(h1->free_nodes, h2->free_nodes);
+  h->slabs = heap_join_slabs(h1->slabs, h2->slabs);
+
   memset(h1, 0, sizeof (*h1));
   memset(h2, 0, sizeof (*h2));
 
@@ -316,7 +401,7 @@ int heap_decrease_key(heap_t *h, heap_node_t *n, void *v)
   return heap_decrease_key_no_replace(h, n);
 }
 
-int heap_decrease_key_no_replace(heap_t *h, heap_node_t *n)
+static int fib_decrease_key(heap_t *h, heap_node_t *n)
 {
   /* No tests that the value hasn't actually increased.  Change *
    * occurs in place, so the check is not possible here.  The   *
@@ -338,6 +423,471 @@ int heap_decrease_key_no_replace(heap_t *h, heap_node_t *n)
   return 0;
 }
 
+/* Pairing heap.  Children hang off their parent's child pointer in a  *
+ * NULL-terminated list, linked by next and prev; every child knows    *
+ * its parent, so a node can be cut out of the list it's in.           */
+static heap_node_t *pairing_meld(heap_t *h, heap_node_t *a, heap_node_t *b)
+{
+  if (!a) {
+    return b;
+  }
+  if (!b) {
+    return a;
+  }
+  if (h->compare(b->datum, a->datum) < 0) {
+    swap(a, b);
+  }
+
+  b->parent = a;
+  b->prev = NULL;
+  b->next = a->child;
+  if (a->child) {
+    a->child->prev = b;
+  }
+  a->child = b;
+
+  return a;
+}
+
+/* Melds the children of a removed root in pairs from the left, then *
+ * melds the pairs into one tree from the right.                      */
+static heap_node_t *pairing_merge_pairs(heap_t *h, heap_node_t *list)
+{
+  heap_node_t *a, *b, *next, *pairs;
+  HEAP_STAT(uint32_t roots = 0);
+
+  HEAP_STAT(heap_stats_add(h->stats->consolidations, 1));
+
+  for (pairs = NULL; list; list = next) {
+    a = list;
+    b = a->next;
+    HEAP_STAT(roots += 1 + !!b);
+    next = b ? b->next : NULL;
+    a->next = a->prev = a->parent = NULL;
+    if (b) {
+      b->next = b->prev = b->parent = NULL;
+    }
+    a = pairing_meld(h, a, b);
+    a->next = pairs;
+    pairs = a;
+  }
+
+  HEAP_STAT(HEAP_STAT_MAX(h->stats->max_roots, roots));
+
+  for (a = NULL; pairs; pairs = next) {
+    next = pairs->next;
+    pairs->next = NULL;
+    a = pairing_meld(h, a, pairs);
+  }
+
+  return a;
+}
+
+static void pairing_insert(heap_t *h, heap_node_t *n)
+{
+  h->min = pairing_meld(h, h->min, n);
+  h->size++;
+}
+
+static void *pairing_remove_min(heap_t *h)
+{
+  heap_node_t *n;
+  void *v;
+
+  if (!(n = h->min)) {
+    return NULL;
+  }
+
+  h->min = pairing_merge_pairs(h, n->child);
+  h->size--;
+  v = n->datum;
+  heap_free_node(h, n);
+
+  return v;
+}
+
+static int pairing_decrease_key(heap_t *h, heap_node_t *n)
+{
+  if (n == h->min ||
+      (n->parent && h->compare(n->datum, n->parent->datum) >= 0)) {
+    return 0;
+  }
+
+  if (n->prev) {
+    n->prev->next = n->next;
+  } else {
+    n->parent->child = n->next;
+  }
+  if (n->next) {
+    n->next->prev = n->prev;
+  }
+  n->next = n->prev = n->parent = NULL;
+
+  h->min = pairing_meld(h, h->min, n);
+
+  return 0;
+}
+
+static void pairing_delete(heap_t *h, heap_node_t *n)
+{
+  heap_node_t *next;
+
+  for (; n; n = next) {
+    next = n->next;
+    if (n->child) {
+      pairing_delete(h, n->child);
+    }
+    if (h->datum_delete) {
+      h->datum_delete(n->datum);
+    }
+  }
+}
+
+/* Implicit 4-ary heap in array, which doubles as it fills.  Each node *
+ * keeps its index in degree, so that it can be found to sift up.     */
+static void quaternary_place(heap_t *h, heap_node_t *n, uint32_t i)
+{
+  h->array[i] = n;
+  n->degree = i;
+}
+
+static void quaternary_sift_up(heap_t *h, uint32_t i)
+{
+  heap_node_t *n;
+  uint32_t p;
+
+  for (n = h->array[i]; i; i = p) {
+    p = (i - 1) / 4;
+    if (h->compare(n->datum, h->array[p]->datum) >= 0) {
+      break;
+    }
+    quaternary_place(h, h->array[p], i);
+  }
+  quaternary_place(h, n, i);
+}
+
+static void quaternary_sift_down(heap_t *h, uint32_t i)
+{
+  heap_node_t *n;
+  uint32_t c, j, min;
+
+  for (n = h->array[i]; (c = 4 * i + 1) < h->size; i = min) {
+    for (min = c, j = c + 1; j < c + 4 && j < h->size; j++) {
+      if (h->compare(h->array[j]->datum, h->array[min]->datum) < 0) {
+        min = j;
+      }
+    }
+    if (h->compare(h->array[min]->datum, n->datum) >= 0) {
+      break;
+    }
+    quaternary_place(h, h->array[min], i);
+  }
+  quaternary_place(h, n, i);
+}
+
+static void quaternary_insert(heap_t *h, heap_node_t *n)
+{
+  if (h->size == h->capacity) {
+    h->capacity = h->capacity ? 2 * h->capacity : HEAP_MIN_SLAB;
+    assert((h->array = realloc(h->array,
+                               h->capacity * sizeof (*h->array))));
+  }
+
+  quaternary_place(h, n, h->size++);
+  quaternary_sift_up(h, n->degree);
+  h->min = h->array[0];
+}
+
+static void *quaternary_remove_min(heap_t *h)
+{
+  heap_node_t *n;
+  void *v;
+
+  if (!(n = h->min)) {
+    return NULL;
+  }
+
+  if (--h->size) {
+    quaternary_place(h, h->array[h->size], 0);
+    quaternary_sift_down(h, 0);
+    h->min = h->array[0];
+  } else {
+    h->min = NULL;
+  }
+  v = n->datum;
+  heap_free_node(h, n);
+
+  return v;
+}
+
+static int quaternary_decrease_key(heap_t *h, heap_node_t *n)
+{
+  quaternary_sift_up(h, n->degree);
+  h->min = h->array[0];
+
+  return 0;
+}
+
+/* Radix heap over the 64-bit keys from h->key, for monotone queues,  *
+ * where nothing is ever inserted or decreased below the last key     *
+ * removed (Dijkstra, or the turn queue).  Bucket b holds the nodes    *
+ * whose key first differs from that last key in bit b - 1, so bucket  *
+ * 0 holds the ones equal to it.  When bucket 0 runs out, the lowest   *
+ * nonempty bucket is spread over the buckets below it.  Buckets are   *
+ * lists through next and prev, and each node keeps its bucket in      *
+ * degree.                                                             */
+static uint32_t radix_bucket(const heap_t *h, uint64_t k)
+{
+  return k == h->last ? 0 : 64 - __builtin_clzll(k ^ h->last);
+}
+
+static void radix_link(heap_t *h, heap_node_t *n)
+{
+  uint64_t k;
+
+  k = h->key(n->datum);
+  assert(k >= h->last);
+
+  n->degree = radix_bucket(h, k);
+  n->prev = NULL;
+  n->next = h->array[n->degree];
+  if (n->next) {
+    n->next->prev = n;
+  }
+  h->array[n->degree] = n;
+}
+
+static void radix_unlink(heap_t *h, heap_node_t *n)
+{
+  if (n->prev) {
+    n->prev->next = n->next;
+  } else {
+    h->array[n->degree] = n->next;
+  }
+  if (n->next) {
+    n->next->prev = n->prev;
+  }
+}
+
+static heap_node_t *radix_min(heap_t *h)
+{
+  heap_node_t *n, *next;
+  uint32_t b;
+
+  if (!h->size) {
+    return NULL;
+  }
+
+  if (!h->array[0]) {
+    for (b = 1; !h->array[b]; b++)
+      ;
+    for (h->last = UINT64_MAX, n = h->array[b]; n; n = n->next) {
+      if (h->key(n->datum) < h->last) {
+        h->last = h->key(n->datum);
+      }
+    }
+    for (n = h->array[b], h->array[b] = NULL; n; n = next) {
+      next = n->next;
+      radix_link(h, n);
+    }
+  }
+
+  return h->array[0];
+}
+
+static void radix_insert(heap_t *h, heap_node_t *n)
+{
+  radix_link(h, n);
+  h->size++;
+}
+
+static void *radix_remove_min(heap_t *h)
+{
+  heap_node_t *n;
+  void *v;
+
+  if (!(n = radix_min(h))) {
+    return NULL;
+  }
+
+  radix_unlink(h, n);
+  h->size--;
+  v = n->datum;
+  heap_free_node(h, n);
+
+  return v;
+}
+
+static int radix_decrease_key(heap_t *h, heap_node_t *n)
+{
+  radix_unlink(h, n);
+  radix_link(h, n);
+
+  return 0;
+}
+
+static const struct heap_ops {
+  void (*insert)(heap_t *h, heap_node_t *n);
+  void *(*remove_min)(heap_t *h);
+  int (*decrease_key)(heap_t *h, heap_node_t *n);
+} heap_ops[num_heap_backends] = {
+  { fib_insert,         fib_remove_min,         fib_decrease_key         },
+  { pairing_insert,     pairing_remove_min,     pairing_decrease_key     },
+  { quaternary_insert,  quaternary_remove_min,  quaternary_decrease_key  },
+  { radix_insert,       radix_remove_min,       radix_decrease_key       },
+};
+
+void (*heap_trace)(const heap_t *h, heap_op_t op, const void *v);
+
+void heap_delete(heap_t *h)
+{
+  struct heap_slab *s;
+  uint32_t i;
+
+  if (heap_trace) {
+    heap_trace(h, heap_op_delete, NULL);
+  }
+
+  switch (h->backend) {
+  case heap_fibonacci:
+    if (h->min) {
+      fib_delete(h, h->min);
+    }
+    break;
+  case heap_pairing:
+    pairing_delete(h, h->min);
+    break;
+  case heap_quaternary:
+    for (i = 0; h->datum_delete && i < h->size; i++) {
+      h->datum_delete(h->array[i]->datum);
+    }
+    break;
+  case heap_radix:
+    for (i = 0; h->datum_delete && i < HEAP_RADIX_BUCKETS; i++) {
+      for (; h->array[i]; h->array[i] = h->array[i]->next) {
+        h->datum_delete(h->array[i]->datum);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+
+  free(h->array);
+  while ((s = h->slabs)) {
+    h->slabs = s->next;
+    free(s);
+  }
+  h->array = NULL;
+  h->capacity = 0;
+  h->free_nodes = NULL;
+  h->min = NULL;
+  h->size = 0;
+  h->compare = NULL;
+  h->datum_delete = NULL;
+}
+
+heap_node_t *heap_insert(heap_t *h, void *v)
+{
+  heap_node_t *n;
+
+  n = heap_alloc_node(h);
+  n->datum = v;
+
+  if (heap_trace) {
+    heap_trace(h, heap_op_insert, v);
+  }
+
+  heap_ops[h->backend].insert(h, n);
+
+  HEAP_STAT(heap_stats_add(h->stats->inserts, 1));
+  HEAP_STAT(HEAP_STAT_MAX(h->stats->peak_size, h->size));
+
+  return n;
+}
+
+void *heap_peek_min(heap_t *h)
+{
+  heap_node_t *n;
+
+  n = h->backend == heap_radix ? radix_min(h) : h->min;
+
+  return n ? n->datum : NULL;
+}
+
+void *heap_remove_min(heap_t *h)
+{
+  void *v;
+
+  v = heap_ops[h->backend].remove_min(h);
+
+  HEAP_STAT(heap_stats_add(h->stats->removes, !!v));
+
+  if (heap_trace && v) {
+    heap_trace(h, heap_op_remove, v);
+  }
+
+  return v;
+}
+
+int heap_decrease_key_no_replace(heap_t *h, heap_node_t *n)
+{
+  if (heap_trace) {
+    heap_trace(h, heap_op_decrease, n->datum);
+  }
+
+  HEAP_STAT(heap_stats_add(h->stats->decreases, 1));
+
+  return heap_ops[h->backend].decrease_key(h, n);
+}
+
+#ifdef HEAP_STATS
+static heap_stats_t heap_stats[HEAP_STATS_SITES];
+static pthread_mutex_t heap_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+heap_stats_t *heap_stats_find(const char *site)
+{
+  uint32_t i;
+
+  pthread_mutex_lock(&heap_stats_lock);
+  for (i = 0; i < HEAP_STATS_SITES && heap_stats[i].site; i++) {
+    if (!strcmp(heap_stats[i].site, site)) {
+      break;
+    }
+  }
+  assert(i < HEAP_STATS_SITES);
+  heap_stats[i].site = site;
+  pthread_mutex_unlock(&heap_stats_lock);
+
+  return heap_stats + i;
+}
+
+/* Other threads may still be counting, so these are a snapshot. */
+void heap_stats_print(FILE *f)
+{
+  uint32_t i;
+
+  pthread_mutex_lock(&heap_stats_lock);
+  fprintf(f, "%-16s %12s %12s %12s %12s %9s %9s\n", "site", "inserts",
+          "removes", "decreases", "consolidate", "max roots", "peak size");
+  for (i = 0; i < HEAP_STATS_SITES && heap_stats[i].site; i++) {
+    if (!heap_stats_load(heap_stats[i].inserts)) {
+      continue;
+    }
+    fprintf(f, "%-16s %12llu %12llu %12llu %12llu %9u %9u\n",
+            heap_stats[i].site,
+            (unsigned long long) heap_stats_load(heap_stats[i].inserts),
+            (unsigned long long) heap_stats_load(heap_stats[i].removes),
+            (unsigned long long) heap_stats_load(heap_stats[i].decreases),
+            (unsigned long long)
+            heap_stats_load(heap_stats[i].consolidations),
+            heap_stats_load(heap_stats[i].max_roots),
+            heap_stats_load(heap_stats[i].peak_size));
+  }
+  pthread_mutex_unlock(&heap_stats_lock);
+}
+#endif
+
 #ifdef TESTING
 
 int32_t compare(const void *key, const void *with)
@@ -6,21 +6,96 @@ extern "C" {
 # endif
 
 # include <stdint.h>
+# include <stdio.h>
 
-struct heap_node;
+/* Nodes are visible so that callers can supply storage for them with *
+ * heap_add_nodes(); their fields are private to heap.c.               */
 typedef struct heap_node heap_node_t;
+struct heap_node {
+  heap_node_t *next;
+  heap_node_t *prev;
+  heap_node_t *parent;
+  heap_node_t *child;
+  void *datum;
+  uint32_t degree;
+  uint32_t mark;
+};
 
+struct heap_slab;
+
+/* The queue behind a heap, chosen at heap_init_backend() time.  All of *
+ * them keep their nodes in the same heap_node_t and take the same      *
+ * calls; only the Fibonacci heap supports heap_combine().  The radix   *
+ * heap orders by the 64-bit key that key() returns rather than by      *
+ * compare(), and requires that no datum inserted or decreased ever has *
+ * a key below that of the last one removed.                            */
+typedef enum heap_backend {
+  heap_fibonacci,
+  heap_pairing,
+  heap_quaternary,
+  heap_radix,
+  num_heap_backends
+} heap_backend_t;
+
+/* Operation counts, kept per call site when HEAP_STATS is defined     *
+ * (make HEAP_STATS=1) and compiled out otherwise.  Every heap, and    *
+ * every pqueue, counts into the site it was named for with            *
+ * heap_stats_site(), or into "other".  roots is the longest list of   *
+ * trees a removal had to consolidate (Fibonacci) or pair up (pairing). *
+ * Heaps of the same site run on several threads at once, so the       *
+ * counters are only touched through heap_stats_add() and              *
+ * heap_stats_max(), which are relaxed atomics.                         */
+typedef struct heap_stats {
+  const char *site;
+  uint64_t inserts;
+  uint64_t removes;
+  uint64_t decreases;
+  uint64_t consolidations;
+  uint32_t max_roots;
+  uint32_t peak_size;
+} heap_stats_t;
+
+/* Removed nodes go on a free list and are reused by later inserts.    *
+ * When it runs dry, the heap allocates another slab of nodes, which   *
+ * it keeps until heap_delete().  Nodes added with heap_add_nodes() go *
+ * on the same list but belong to the caller and are never freed.      */
 typedef struct heap {
   heap_node_t *min;
   uint32_t size;
   int32_t (*compare)(const void *key, const void *with);
   void (*datum_delete)(void *);
+  heap_node_t *free_nodes;
+  struct heap_slab *slabs;
+  heap_backend_t backend;
+  uint64_t (*key)(const void *v);
+  heap_node_t **array;
+  uint32_t capacity;
+  uint64_t last;
+# ifdef HEAP_STATS
+  heap_stats_t *stats;
+# endif
 } heap_t;
 
+/* If set, called on every insert, removal, decrease and heap_delete(), *
+ * with the datum concerned, so that queue traffic can be recorded.     */
+typedef enum heap_op {
+  heap_op_insert,
+  heap_op_remove,
+  heap_op_decrease,
+  heap_op_delete
+} heap_op_t;
+
+extern void (*heap_trace)(const heap_t *h, heap_op_t op, const void *v);
+
 void heap_init(heap_t *h,
                int32_t (*compare)(const void *key, const void *with),
                void (*datum_delete)(void *));
+void heap_init_backend(heap_t *h, heap_backend_t backend,
+                       int32_t (*compare)(const void *key, const void *with),
+                       uint64_t (*key)(const void *v),
+                       void (*datum_delete)(void *));
 void heap_delete(heap_t *h);
+void heap_add_nodes(heap_t *h, heap_node_t *nodes, uint32_t n);
 heap_node_t *heap_insert(heap_t *h, void *v);
 void *heap_peek_min(heap_t *h);
 void *heap_remove_min(heap_t *h);
@@ -28,6 +103,29 @@ int heap_combine(heap_t *h, heap_t *h1, heap_t *h2);
 int heap_decrease_key(heap_t *h, heap_node_t *n, void *v);
 int heap_decrease_key_no_replace(heap_t *h, heap_node_t *n);
 
+# ifdef HEAP_STATS
+#  define heap_stats_add(c, n) \
+  __atomic_fetch_add(&(c), (n), __ATOMIC_RELAXED)
+
+static inline void heap_stats_max(uint32_t *m, uint32_t v)
+{
+  uint32_t old;
+
+  old = __atomic_load_n(m, __ATOMIC_RELAXED);
+  while (v > old &&
+         !__atomic_compare_exchange_n(m, &old, v, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+}
+
+heap_stats_t *heap_stats_find(const char *site);
+#  define heap_stats_site(h, name) ((h)->stats = heap_stats_find(name))
+void heap_stats_print(FILE *f);
+# else
+#  define heap_stats_site(h, name)
+#  define heap_stats_print(f)
+# endif
+
 # ifdef __cplusplus
 }
 # endif
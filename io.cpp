@@ -131,6 +131,7 @@ static character *io_nearest_visible_trainer()
   }
 
   /* Sort it by distance from PC */
+  pathfind_need(char_rival);
   qsort(c, count, sizeof (*c), compare_trainer_distance);
 
   n = c[0];
@@ -239,6 +240,7 @@ uint32_t io_teleport_pc(pair_t dest)
 {
   /* Just for fun. And debugging.  Mostly debugging. */
 
+  pathfind_need(char_rival);
   do {
     dest[dim_x] = rand_range(1, MAP_X - 2);
     dest[dim_y] = rand_range(1, MAP_Y - 2);
@@ -343,6 +345,7 @@ static void io_list_trainers()
   }
 
   /* Sort it by distance from PC */
+  pathfind_need(char_rival);
   qsort(c, count, sizeof (*c), compare_trainer_distance);
 
   /* Display it */
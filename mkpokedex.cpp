@@ -0,0 +1,271 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include "db_parse.h"
+
+/* Writes the pokedex out as C++ source with a constexpr array for every *
+ * table, for builds that carry their pokedex inside the binary (make     *
+ * EMBED=1).  The tables are read exactly as the game would read them.    */
+
+static void usage(const char *s)
+{
+  fprintf(stderr, "Usage: %s <csv directory> <output>\n", s);
+
+  exit(1);
+}
+
+/* Names are plain ASCII, but be safe about it. */
+static void quote(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+    }
+    if (*s < ' ' || *s > '~') {
+      fprintf(f, "\\%03o", (unsigned char) *s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+static void emit_column(FILE *f, const int *c)
+{
+  int i;
+
+  fprintf(f, "  {");
+  for (i = 0; i < NUM_POKEMON_MOVES; i++) {
+    fprintf(f, "%s%d,", i % 16 ? " " : "\n    ", c[i]);
+  }
+  fprintf(f, "\n  },\n");
+}
+
+static void emit_pokemon_moves(FILE *f)
+{
+  const pokemon_move_columns *m = pokemon_moves;
+
+  fprintf(f, "static constexpr pokemon_move_columns pokemon_move_data = {\n");
+  emit_column(f, m->pokemon_id);
+  emit_column(f, m->version_group_id);
+  emit_column(f, m->move_id);
+  emit_column(f, m->pokemon_move_method_id);
+  emit_column(f, m->level);
+  emit_column(f, m->order);
+  fprintf(f, "};\n\n"
+          "constexpr const pokemon_move_columns *pokemon_moves = "
+          "&pokemon_move_data;\n\n");
+}
+
+static void emit_pokemon(FILE *f)
+{
+  const pokemon_db *p = Pokemon;
+  int i;
+
+  fprintf(f, "constexpr pokemon_db Pokemon[NUM_POKEMON] = {\n");
+  for (i = 0; i < NUM_POKEMON; i++) {
+    fprintf(f, "  { %d, %u, %d, %d, %d, %d, %d, %d },\n",
+            p[i].id, p[i].identifier, p[i].species_id, p[i].height,
+            p[i].weight, p[i].base_experience, p[i].order, p[i].is_default);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_types(FILE *f)
+{
+  const char *const *t = types;
+  int i;
+
+  fprintf(f, "constexpr const char *types[NUM_TYPES] = {\n");
+  for (i = 0; i < NUM_TYPES; i++) {
+    fprintf(f, "  ");
+    if (t[i]) {
+      quote(f, t[i]);
+    } else {
+      fprintf(f, "nullptr");
+    }
+    fprintf(f, ",\n");
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_moves(FILE *f)
+{
+  const move_db *m = moves;
+  int i;
+
+  fprintf(f, "constexpr move_db moves[NUM_MOVES] = {\n");
+  for (i = 0; i < NUM_MOVES; i++) {
+    fprintf(f, "  { %d, %u, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, "
+            "%d },\n",
+            m[i].id, m[i].identifier, m[i].generation_id, m[i].type_id,
+            m[i].power, m[i].pp, m[i].accuracy, m[i].priority, m[i].target_id,
+            m[i].damage_class_id, m[i].effect_id, m[i].effect_chance,
+            m[i].contest_type_id, m[i].contest_effect_id,
+            m[i].super_contest_effect_id);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_species(FILE *f)
+{
+  const pokemon_species_db *s = species;
+  int i;
+
+  fprintf(f, "constexpr pokemon_species_db species[NUM_SPECIES] = {\n");
+  for (i = 0; i < NUM_SPECIES; i++) {
+    fprintf(f, "  { %d, %u, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, "
+            "%d, %d, %d, %d, %d, %d,\n    { %d, %d, %d, %d, %d, %d } },\n",
+            s[i].id, s[i].identifier, s[i].generation_id,
+            s[i].evolves_from_species_id, s[i].evolution_chain_id,
+            s[i].color_id, s[i].shape_id, s[i].habitat_id,
+            s[i].gender_rate, s[i].capture_rate, s[i].base_happiness, s[i].is_baby, s[i].hatch_counter,
+            s[i].has_gender_differences, s[i].growth_rate_id,
+            s[i].forms_switchable, s[i].is_legendary, s[i].is_mythical,
+            s[i].order, s[i].conquest_order,
+            s[i].base_stat[0], s[i].base_stat[1], s[i].base_stat[2],
+            s[i].base_stat[3], s[i].base_stat[4], s[i].base_stat[5]);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_experience(FILE *f)
+{
+  const experience_db *e = experience;
+  int i;
+
+  fprintf(f, "constexpr experience_db experience[NUM_EXPERIENCE] = {\n");
+  for (i = 0; i < NUM_EXPERIENCE; i++) {
+    fprintf(f, "  { %d, %d, %d },\n",
+            e[i].growth_rate_id, e[i].level, e[i].experience);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_pokemon_stats(FILE *f)
+{
+  const pokemon_stats_db *p = pokemon_stats;
+  int i;
+
+  fprintf(f, "constexpr pokemon_stats_db pokemon_stats[NUM_POKEMON_STATS] = "
+          "{\n");
+  for (i = 0; i < NUM_POKEMON_STATS; i++) {
+    fprintf(f, "  { %d, %d, %d, %d },\n",
+            p[i].pokemon_id, p[i].stat_id, p[i].base_stat, p[i].effort);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_stats(FILE *f)
+{
+  const stats_db *s = stats;
+  int i;
+
+  fprintf(f, "constexpr stats_db stats[NUM_STATS] = {\n");
+  for (i = 0; i < NUM_STATS; i++) {
+    fprintf(f, "  { %d, %d, %u, %d, %d },\n",
+            s[i].id, s[i].damage_class_id, s[i].identifier,
+            s[i].is_battle_only, s[i].game_index);
+  }
+  fprintf(f, "};\n\n");
+}
+
+static void emit_pokemon_types(FILE *f)
+{
+  const pokemon_types_db *p = pokemon_types;
+  int i;
+
+  fprintf(f, "constexpr pokemon_types_db pokemon_types[NUM_POKEMON_TYPES] = "
+          "{\n");
+  for (i = 0; i < NUM_POKEMON_TYPES; i++) {
+    fprintf(f, "  { %d, %d, %d },\n",
+            p[i].pokemon_id, p[i].type_id, p[i].slot);
+  }
+  fprintf(f, "};\n\n");
+}
+
+/* One literal per string, NUL and all; the compiler adds one more NUL *
+ * at the very end, which nothing points at.                          */
+static void emit_strings(FILE *f)
+{
+  const char *s = db_strings;
+  uint32_t o, n;
+
+  n = db_strings_size();
+
+  fprintf(f, "constexpr char db_strings[] =\n");
+  for (o = 0; o < n; o += strlen(s + o) + 1) {
+    fprintf(f, "  ");
+    quote(f, s + o);
+    fprintf(f, " \"\\000\"\n");
+  }
+  fprintf(f, "  ;\n\n"
+          "uint32_t db_strings_size()\n"
+          "{\n"
+          "  return %u;\n"
+          "}\n\n", n);
+}
+
+static void emit_learnsets(FILE *f)
+{
+  const uint32_t *o = learnset_offset;
+  const levelup_move *l = learnset;
+  uint32_t i;
+
+  fprintf(f, "constexpr uint32_t learnset_offset[NUM_SPECIES + 1] = {\n");
+  for (i = 0; i <= NUM_SPECIES; i++) {
+    fprintf(f, "  %u,\n", o[i]);
+  }
+  fprintf(f, "};\n\n");
+
+  /* Arrays can't be empty, so pad an empty learnset with a dummy. */
+  fprintf(f, "constexpr levelup_move learnset[%u] = {\n",
+          o[NUM_SPECIES] ? o[NUM_SPECIES] : 1);
+  for (i = 0; i < o[NUM_SPECIES]; i++) {
+    fprintf(f, "  { %d, %d },\n", l[i].level, l[i].move);
+  }
+  if (!o[NUM_SPECIES]) {
+    fprintf(f, "  { 0, 0 },\n");
+  }
+  fprintf(f, "};\n");
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *f;
+
+  if (argc != 3) {
+    usage(argv[0]);
+  }
+
+  db_open(argv[1]);
+
+  if (!(f = fopen(argv[2], "w"))) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  fprintf(f, "/* Generated by mkpokedex from %s.  Do not edit. */\n\n"
+          "#include \"db_parse.h\"\n\n", argv[1]);
+
+  emit_pokemon_moves(f);
+  emit_pokemon(f);
+  emit_types(f);
+  emit_moves(f);
+  emit_species(f);
+  emit_experience(f);
+  emit_pokemon_stats(f);
+  emit_stats(f);
+  emit_pokemon_types(f);
+  emit_strings(f);
+  emit_learnsets(f);
+
+  if (fclose(f)) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
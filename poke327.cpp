@@ -8,16 +8,62 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <atomic>
+#include <algorithm>
 
 #include "heap.h"
 #include "poke327.h"
 #include "io.h"
 #include "db_parse.h"
+#include "bench.h"
+#include "rng.h"
+
+/* Streams of the per-map generator, see rng.h. */
+enum {
+  rng_map,
+  rng_exit_ns,
+  rng_exit_ew
+};
 
-typedef struct queue_node {
-  int x, y;
-  struct queue_node *next;
-} queue_node_t;
+/* Breadth-first frontier for the flood fills that grow terrain and *
+ * height.  A cell is never queued twice at once, so a ring of one   *
+ * entry per cell always has room, and the fills share one ring     *
+ * instead of allocating a node per cell.  Like all the scratch      *
+ * space of map generation, it is per thread, since neighbouring     *
+ * maps are generated in the background.                             */
+#define QUEUE_SIZE (MAP_Y * MAP_X + 1) /* + 1 so full isn't empty */
+
+typedef struct queue {
+  uint8_t cell[QUEUE_SIZE][2];
+  uint32_t head, tail;
+} queue_t;
+
+static thread_local queue_t frontier;
+
+static inline void queue_push(queue_t *q, int x, int y)
+{
+  q->cell[q->tail][dim_x] = x;
+  q->cell[q->tail][dim_y] = y;
+  q->tail = q->tail == QUEUE_SIZE - 1 ? 0 : q->tail + 1;
+}
+
+/* Returns 0 when the queue is empty. */
+static inline int queue_pop(queue_t *q, int32_t *x, int32_t *y)
+{
+  if (q->head == q->tail) {
+    return 0;
+  }
+
+  *x = q->cell[q->head][dim_x];
+  *y = q->cell[q->head][dim_y];
+  q->head = q->head == QUEUE_SIZE - 1 ? 0 : q->head + 1;
+
+  return 1;
+}
 
 world_t world;
 
@@ -32,10 +78,6 @@ pair_t all_dirs[8] = {
   {  1,  1 },
 };
 
-static int32_t path_cmp(const void *key, const void *with) {
-  return ((path_t *) key)->cost - ((path_t *) with)->cost;
-}
-
 static int32_t edge_penalty(int8_t x, int8_t y)
 {
   return (x == 1 || y == 1 || x == MAP_X - 2 || y == MAP_Y - 2) ? 2 : 1;
@@ -43,9 +85,10 @@ static int32_t edge_penalty(int8_t x, int8_t y)
 
 static void dijkstra_path(map_t *m, pair_t from, pair_t to)
 {
-  static path_t path[MAP_Y][MAP_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
+  static thread_local path_t path[MAP_Y][MAP_X], *p;
+  static thread_local uint8_t settled[MAP_Y][MAP_X];
+  static thread_local pqueue<int32_t, path_t *> q;
+  static thread_local uint32_t initialized = 0;
   int32_t x, y;
 
   if (!initialized) {
@@ -55,27 +98,31 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
         path[y][x].pos[dim_x] = x;
       }
     }
+    q.init();
+    heap_stats_site(&q, "dijkstra_path");
     initialized = 1;
   }
   
   for (y = 0; y < MAP_Y; y++) {
     for (x = 0; x < MAP_X; x++) {
       path[y][x].cost = INT_MAX;
+      settled[y][x] = !y || !x || y == MAP_Y - 1 || x == MAP_X - 1;
     }
   }
 
   path[from[dim_y]][from[dim_x]].cost = 0;
 
-  heap_init(&h, path_cmp, NULL);
+  /* Cells are queued again each time their cost drops, so a cell comes *
+   * out once with its final cost, and any later copies are skipped.    */
+  q.clear();
+  q.insert(0, &path[from[dim_y]][from[dim_x]]);
 
-  for (y = 1; y < MAP_Y - 1; y++) {
-    for (x = 1; x < MAP_X - 1; x++) {
-      path[y][x].hn = heap_insert(&h, &path[y][x]);
+  while (q.size()) {
+    p = q.remove_min();
+    if (settled[p->pos[dim_y]][p->pos[dim_x]]) {
+      continue;
     }
-  }
-
-  while ((p = (path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
+    settled[p->pos[dim_y]][p->pos[dim_x]] = 1;
 
     if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
       for (x = to[dim_x], y = to[dim_y];
@@ -84,11 +131,10 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
         mapxy(x, y) = ter_path;
         heightxy(x, y) = 0;
       }
-      heap_delete(&h);
       return;
     }
 
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
+    if (!settled[p->pos[dim_y] - 1][p->pos[dim_x]    ] &&
         (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
          ((p->cost + heightpair(p->pos)) *
           edge_penalty(p->pos[dim_x], p->pos[dim_y] - 1)))) {
@@ -97,10 +143,10 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
          edge_penalty(p->pos[dim_x], p->pos[dim_y] - 1));
       path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
       path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
+      q.insert(path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost,
+               &path[p->pos[dim_y] - 1][p->pos[dim_x]    ]);
     }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
+    if (!settled[p->pos[dim_y]    ][p->pos[dim_x] - 1] &&
         (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
          ((p->cost + heightpair(p->pos)) *
           edge_penalty(p->pos[dim_x] - 1, p->pos[dim_y])))) {
@@ -109,10 +155,10 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
          edge_penalty(p->pos[dim_x] - 1, p->pos[dim_y]));
       path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
       path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
+      q.insert(path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost,
+               &path[p->pos[dim_y]    ][p->pos[dim_x] - 1]);
     }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
+    if (!settled[p->pos[dim_y]    ][p->pos[dim_x] + 1] &&
         (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
          ((p->cost + heightpair(p->pos)) *
           edge_penalty(p->pos[dim_x] + 1, p->pos[dim_y])))) {
@@ -121,10 +167,10 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
          edge_penalty(p->pos[dim_x] + 1, p->pos[dim_y]));
       path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
       path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
+      q.insert(path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost,
+               &path[p->pos[dim_y]    ][p->pos[dim_x] + 1]);
     }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
+    if (!settled[p->pos[dim_y] + 1][p->pos[dim_x]    ] &&
         (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
          ((p->cost + heightpair(p->pos)) *
           edge_penalty(p->pos[dim_x], p->pos[dim_y] + 1)))) {
@@ -133,8 +179,8 @@ static void dijkstra_path(map_t *m, pair_t from, pair_t to)
          edge_penalty(p->pos[dim_x], p->pos[dim_y] + 1));
       path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
       path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
+      q.insert(path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost,
+               &path[p->pos[dim_y] + 1][p->pos[dim_x]    ]);
     }
   }
 }
@@ -238,11 +284,110 @@ static int gaussian[5][5] = {
   {  1,  4,  7,  4,  1 }
 };
 
-static int smooth_height(map_t *m)
+/* The gaussian, with its taps off the map left out and the rest of  *
+ * the weights rescaled.  Only the benchmark calls this now, as the  *
+ * reference for smooth().                                           */
+static void smooth_reference(const uint8_t in[MAP_Y][MAP_X],
+                             uint8_t out[MAP_Y][MAP_X])
+{
+  int32_t x, y, s, t, p, q;
+
+  for (y = 0; y < MAP_Y; y++) {
+    for (x = 0; x < MAP_X; x++) {
+      for (s = t = p = 0; p < 5; p++) {
+        for (q = 0; q < 5; q++) {
+          if (y + (p - 2) >= 0 && y + (p - 2) < MAP_Y &&
+              x + (q - 2) >= 0 && x + (q - 2) < MAP_X) {
+            s += gaussian[p][q];
+            t += in[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
+          }
+        }
+      }
+      out[y][x] = t / s;
+    }
+  }
+}
+
+/* The same, SMOOTH_LANES cells at a time.  The gaussian isn't quite *
+ * separable, but it is 1 4 7 4 1 across times 1 4 7 4 1 down, less   *
+ * twice a plus with 4 in the middle and 1 on each side.  Zeros       *
+ * around a copy of the map stand in for the taps off it, so the loops *
+ * have no bounds checks, and the sum of the weights that are on the   *
+ * map, which only depends on the cell, is worked out once.           */
+typedef int32_t smooth_vec_t __attribute__ ((vector_size (32)));
+typedef int32_t smooth_uvec_t __attribute__ ((vector_size (32), aligned (4)));
+
+#define SMOOTH_LANES (sizeof (smooth_vec_t) / sizeof (int32_t))
+#define SMOOTH_LOAD(p) (*(const smooth_uvec_t *) (p))
+
+static_assert(MAP_X % SMOOTH_LANES == 0, "rows must be whole vectors");
+
+static void smooth(const uint8_t in[MAP_Y][MAP_X], uint8_t out[MAP_Y][MAP_X])
+{
+  static const int32_t row[5] = { 1, 4, 7, 4, 1 };
+  static thread_local int32_t weight[MAP_Y][MAP_X];
+  static thread_local uint32_t initialized = 0;
+  int32_t pad[MAP_Y + 4][MAP_X + 4], across[MAP_Y + 4][MAP_X];
+  smooth_vec_t v, plus;
+  uint32_t x, y, i;
+  int32_t p, q;
+
+  if (!initialized) {
+    for (y = 0; y < MAP_Y; y++) {
+      for (x = 0; x < MAP_X; x++) {
+        for (weight[y][x] = p = 0; p < 5; p++) {
+          for (q = 0; q < 5; q++) {
+            if (y + p >= 2 && y + p < MAP_Y + 2 &&
+                x + q >= 2 && x + q < MAP_X + 2) {
+              weight[y][x] += gaussian[p][q];
+            }
+          }
+        }
+      }
+    }
+    initialized = 1;
+  }
+
+  memset(pad, 0, sizeof (pad));
+  for (y = 0; y < MAP_Y; y++) {
+    for (x = 0; x < MAP_X; x++) {
+      pad[y + 2][x + 2] = in[y][x];
+    }
+  }
+
+  for (y = 0; y < MAP_Y + 4; y++) {
+    for (x = 0; x < MAP_X; x += SMOOTH_LANES) {
+      *(smooth_uvec_t *) &across[y][x] = (SMOOTH_LOAD(&pad[y][x]) * row[0] +
+                                          SMOOTH_LOAD(&pad[y][x + 1]) * row[1] +
+                                          SMOOTH_LOAD(&pad[y][x + 2]) * row[2] +
+                                          SMOOTH_LOAD(&pad[y][x + 3]) * row[3] +
+                                          SMOOTH_LOAD(&pad[y][x + 4]) * row[4]);
+    }
+  }
+
+  for (y = 0; y < MAP_Y; y++) {
+    for (x = 0; x < MAP_X; x += SMOOTH_LANES) {
+      v = (SMOOTH_LOAD(&across[y][x]) * row[0] +
+           SMOOTH_LOAD(&across[y + 1][x]) * row[1] +
+           SMOOTH_LOAD(&across[y + 2][x]) * row[2] +
+           SMOOTH_LOAD(&across[y + 3][x]) * row[3] +
+           SMOOTH_LOAD(&across[y + 4][x]) * row[4]);
+      plus = (SMOOTH_LOAD(&pad[y + 2][x + 2]) * 4 +
+              SMOOTH_LOAD(&pad[y + 1][x + 2]) +
+              SMOOTH_LOAD(&pad[y + 3][x + 2]) +
+              SMOOTH_LOAD(&pad[y + 2][x + 1]) +
+              SMOOTH_LOAD(&pad[y + 2][x + 3]));
+      v = (v - plus * 2) / SMOOTH_LOAD(&weight[y][x]);
+      for (i = 0; i < SMOOTH_LANES; i++) {
+        out[y][x + i] = v[i];
+      }
+    }
+  }
+}
+
+static int smooth_height(map_t *m, rng_t *r)
 {
   int32_t i, x, y;
-  int32_t s, t, p, q;
-  queue_node_t *head, *tail, *tmp;
   /*  FILE *out;*/
   uint8_t height[MAP_Y][MAP_X];
 
@@ -251,19 +396,11 @@ static int smooth_height(map_t *m)
   /* Seed with some values */
   for (i = 1; i < 255; i += 20) {
     do {
-      x = rand() % MAP_X;
-      y = rand() % MAP_Y;
+      x = rng_rand(r) % MAP_X;
+      y = rng_rand(r) % MAP_Y;
     } while (height[y][x]);
     height[y][x] = i;
-    if (i == 1) {
-      head = tail = (queue_node_t *) malloc(sizeof (*tail));
-    } else {
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-    }
-    tail->next = NULL;
-    tail->x = x;
-    tail->y = y;
+    queue_push(&frontier, x, y);
   }
 
   /*
@@ -274,111 +411,46 @@ static int smooth_height(map_t *m)
   */
   
   /* Diffuse the vaules to fill the space */
-  while (head) {
-    x = head->x;
-    y = head->y;
+  while (queue_pop(&frontier, &x, &y)) {
     i = height[y][x];
 
     if (x - 1 >= 0 && y - 1 >= 0 && !height[y - 1][x - 1]) {
       height[y - 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y - 1;
+      queue_push(&frontier, x - 1, y - 1);
     }
     if (x - 1 >= 0 && !height[y][x - 1]) {
       height[y][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y;
+      queue_push(&frontier, x - 1, y);
     }
     if (x - 1 >= 0 && y + 1 < MAP_Y && !height[y + 1][x - 1]) {
       height[y + 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y + 1;
+      queue_push(&frontier, x - 1, y + 1);
     }
     if (y - 1 >= 0 && !height[y - 1][x]) {
       height[y - 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y - 1;
+      queue_push(&frontier, x, y - 1);
     }
     if (y + 1 < MAP_Y && !height[y + 1][x]) {
       height[y + 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y + 1;
+      queue_push(&frontier, x, y + 1);
     }
     if (x + 1 < MAP_X && y - 1 >= 0 && !height[y - 1][x + 1]) {
       height[y - 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y - 1;
+      queue_push(&frontier, x + 1, y - 1);
     }
     if (x + 1 < MAP_X && !height[y][x + 1]) {
       height[y][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y;
+      queue_push(&frontier, x + 1, y);
     }
     if (x + 1 < MAP_X && y + 1 < MAP_Y && !height[y + 1][x + 1]) {
       height[y + 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y + 1;
+      queue_push(&frontier, x + 1, y + 1);
     }
-
-    tmp = head;
-    head = head->next;
-    free(tmp);
   }
 
-  /* And smooth it a bit with a gaussian convolution */
-  for (y = 0; y < MAP_Y; y++) {
-    for (x = 0; x < MAP_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < MAP_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < MAP_X) {
-            s += gaussian[p][q];
-            t += height[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      m->height[y][x] = t / s;
-    }
-  }
-  /* Let's do it again, until it's smooth like Kenny G. */
-  for (y = 0; y < MAP_Y; y++) {
-    for (x = 0; x < MAP_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < MAP_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < MAP_X) {
-            s += gaussian[p][q];
-            t += height[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      m->height[y][x] = t / s;
-    }
-  }
+  /* And smooth it a bit with a gaussian convolution.  This used to *
+   * run twice, but both passes read height, so once is the same.   */
+  smooth(height, m->height);
 
   /*
   out = fopen("diffused.pgm", "w");
@@ -395,11 +467,11 @@ static int smooth_height(map_t *m)
   return 0;
 }
 
-static void find_building_location(map_t *m, pair_t p)
+static void find_building_location(map_t *m, rng_t *r, pair_t p)
 {
   do {
-    p[dim_x] = rand() % (MAP_X - 3) + 1;
-    p[dim_y] = rand() % (MAP_Y - 3) + 1;
+    p[dim_x] = rng_rand(r) % (MAP_X - 3) + 1;
+    p[dim_y] = rng_rand(r) % (MAP_Y - 3) + 1;
 
     if ((((mapxy(p[dim_x] - 1, p[dim_y]    ) == ter_path)     &&
           (mapxy(p[dim_x] - 1, p[dim_y] + 1) == ter_path))    ||
@@ -426,11 +498,11 @@ static void find_building_location(map_t *m, pair_t p)
   } while (1);
 }
 
-static int place_pokemart(map_t *m)
+static int place_pokemart(map_t *m, rng_t *r)
 {
   pair_t p;
 
-  find_building_location(m, p);
+  find_building_location(m, r, p);
 
   mapxy(p[dim_x]    , p[dim_y]    ) = ter_mart;
   mapxy(p[dim_x] + 1, p[dim_y]    ) = ter_mart;
@@ -440,10 +512,10 @@ static int place_pokemart(map_t *m)
   return 0;
 }
 
-static int place_center(map_t *m)
+static int place_center(map_t *m, rng_t *r)
 {  pair_t p;
 
-  find_building_location(m, p);
+  find_building_location(m, r, p);
 
   mapxy(p[dim_x]    , p[dim_y]    ) = ter_center;
   mapxy(p[dim_x] + 1, p[dim_y]    ) = ter_center;
@@ -453,19 +525,19 @@ static int place_center(map_t *m)
   return 0;
 }
 
-static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
+static int map_terrain(map_t *m, rng_t *r,
+                       int8_t n, int8_t s, int8_t e, int8_t w)
 {
   int32_t i, x, y;
-  queue_node_t *head, *tail, *tmp;
   //  FILE *out;
   int num_grass, num_clearing, num_mountain, num_forest, num_total;
   terrain_type_t type;
   int added_current = 0;
   
-  num_grass = rand() % 4 + 2;
-  num_clearing = rand() % 4 + 2;
-  num_mountain = rand() % 2 + 1;
-  num_forest = rand() % 2 + 1;
+  num_grass = rng_rand(r) % 4 + 2;
+  num_clearing = rng_rand(r) % 4 + 2;
+  num_mountain = rng_rand(r) % 2 + 1;
+  num_forest = rng_rand(r) % 2 + 1;
   num_total = num_grass + num_clearing + num_mountain + num_forest;
 
   memset(&m->map, 0, sizeof (m->map));
@@ -473,8 +545,8 @@ static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
   /* Seed with some values */
   for (i = 0; i < num_total; i++) {
     do {
-      x = rand() % MAP_X;
-      y = rand() % MAP_Y;
+      x = rng_rand(r) % MAP_X;
+      y = rng_rand(r) % MAP_Y;
     } while (m->map[y][x]);
     if (i == 0) {
       type = ter_grass;
@@ -486,15 +558,7 @@ static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
       type = ter_forest;
     }
     m->map[y][x] = type;
-    if (i == 0) {
-      head = tail = (queue_node_t *) malloc(sizeof (*tail));
-    } else {
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-    }
-    tail->next = NULL;
-    tail->x = x;
-    tail->y = y;
+    queue_push(&frontier, x, y);
   }
 
   /*
@@ -505,91 +569,54 @@ static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
   */
 
   /* Diffuse the vaules to fill the space */
-  while (head) {
-    x = head->x;
-    y = head->y;
+  while (queue_pop(&frontier, &x, &y)) {
     i = m->map[y][x];
     
     if (x - 1 >= 0 && !m->map[y][x - 1]) {
-      if ((rand() % 100) < 80) {
+      if ((rng_rand(r) % 100) < 80) {
         m->map[y][x - 1] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x - 1;
-        tail->y = y;
+        queue_push(&frontier, x - 1, y);
       } else if (!added_current) {
         added_current = 1;
         m->map[y][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y;
+        queue_push(&frontier, x, y);
       }
     }
 
     if (y - 1 >= 0 && !m->map[y - 1][x]) {
-      if ((rand() % 100) < 20) {
+      if ((rng_rand(r) % 100) < 20) {
         m->map[y - 1][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y - 1;
+        queue_push(&frontier, x, y - 1);
       } else if (!added_current) {
         added_current = 1;
         m->map[y][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y;
+        queue_push(&frontier, x, y);
       }
     }
 
     if (y + 1 < MAP_Y && !m->map[y + 1][x]) {
-      if ((rand() % 100) < 20) {
+      if ((rng_rand(r) % 100) < 20) {
         m->map[y + 1][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y + 1;
+        queue_push(&frontier, x, y + 1);
       } else if (!added_current) {
         added_current = 1;
         m->map[y][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y;
+        queue_push(&frontier, x, y);
       }
     }
 
     if (x + 1 < MAP_X && !m->map[y][x + 1]) {
-      if ((rand() % 100) < 80) {
+      if ((rng_rand(r) % 100) < 80) {
         m->map[y][x + 1] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x + 1;
-        tail->y = y;
+        queue_push(&frontier, x + 1, y);
       } else if (!added_current) {
         added_current = 1;
         m->map[y][x] = (terrain_type_t) i;
-        tail->next = (queue_node_t *) malloc(sizeof (*tail));
-        tail = tail->next;
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y;
+        queue_push(&frontier, x, y);
       }
     }
 
     added_current = 0;
-    tmp = head;
-    head = head->next;
-    free(tmp);
   }
 
   /*
@@ -633,14 +660,14 @@ static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
   return 0;
 }
 
-static int place_boulders(map_t *m)
+static int place_boulders(map_t *m, rng_t *r)
 {
   int i;
   int x, y;
 
-  for (i = 0; i < MIN_BOULDERS || rand() % 100 < BOULDER_PROB; i++) {
-    y = rand() % (MAP_Y - 2) + 1;
-    x = rand() % (MAP_X - 2) + 1;
+  for (i = 0; i < MIN_BOULDERS || rng_rand(r) % 100 < BOULDER_PROB; i++) {
+    y = rng_rand(r) % (MAP_Y - 2) + 1;
+    x = rng_rand(r) % (MAP_X - 2) + 1;
     if (m->map[y][x] != ter_forest && m->map[y][x] != ter_path) {
       m->map[y][x] = ter_boulder;
     }
@@ -649,14 +676,14 @@ static int place_boulders(map_t *m)
   return 0;
 }
 
-static int place_trees(map_t *m)
+static int place_trees(map_t *m, rng_t *r)
 {
   int i;
   int x, y;
   
-  for (i = 0; i < MIN_TREES || rand() % 100 < TREE_PROB; i++) {
-    y = rand() % (MAP_Y - 2) + 1;
-    x = rand() % (MAP_X - 2) + 1;
+  for (i = 0; i < MIN_TREES || rng_rand(r) % 100 < TREE_PROB; i++) {
+    y = rng_rand(r) % (MAP_Y - 2) + 1;
+    x = rng_rand(r) % (MAP_X - 2) + 1;
     if (m->map[y][x] != ter_mountain && m->map[y][x] != ter_path) {
       m->map[y][x] = ter_tree;
     }
@@ -676,6 +703,7 @@ void new_hiker()
   pair_t pos;
   npc *c;
 
+  pathfind_need(char_hiker);
   do {
     rand_pos(pos);
   } while (world.hiker_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
@@ -694,7 +722,7 @@ void new_hiker()
   c->symbol = 'h';
   c->money_given = 1000;
   c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
+  world.cur_map->turn.insert(c->next_turn, c);
   world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
 
   //  printf("Hiker at %d,%d\n", pos[dim_x], pos[dim_y]);
@@ -705,6 +733,7 @@ void new_rival()
   pair_t pos;
   npc *c;
 
+  pathfind_need(char_rival);
   do {
     rand_pos(pos);
   } while (world.rival_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
@@ -724,7 +753,7 @@ void new_rival()
   c->symbol = 'r';
   c->money_given = 1000;
   c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
+  world.cur_map->turn.insert(c->next_turn, c);
   world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
 }
 
@@ -733,6 +762,7 @@ void new_char_other()
   pair_t pos;
   npc *c;
 
+  pathfind_need(char_rival);
   do {
     rand_pos(pos);
   } while (world.rival_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
@@ -767,7 +797,7 @@ void new_char_other()
   rand_dir(c->dir);
   c->defeated = 0;
   c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
+  world.cur_map->turn.insert(c->next_turn, c);
   world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
 }
 
@@ -829,13 +859,11 @@ void init_pc()
   //Pokeballs
   world.pc.items[item_pokeball] = 10;
 
-  heap_insert(&world.cur_map->turn, &world.pc);
+  world.cur_map->turn.insert(world.pc.next_turn, &world.pc);
 }
 
 void place_pc()
 {
-  character *c;
-
   if (world.pc.pos[dim_x] == 1) {
     world.pc.pos[dim_x] = MAP_X - 2;
   } else if (world.pc.pos[dim_x] == MAP_X - 2) {
@@ -848,8 +876,8 @@ void place_pc()
 
   world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = &world.pc;
 
-  if ((c = (character *) heap_peek_min(&world.cur_map->turn))) {
-    world.pc.next_turn = c->next_turn;
+  if (world.cur_map->turn.size()) {
+    world.pc.next_turn = world.cur_map->turn.peek_min()->key;
   } else {
     world.pc.next_turn = 0;
   }
@@ -858,69 +886,304 @@ void place_pc()
 // New map expects cur_idx to refer to the index to be generated.  If that
 // map has already been generated then the only thing this does is set
 // cur_map.
-int new_map(int teleport)
+/* Everything about the map at world index (x, y) that is the same    *
+ * every time it's generated: terrain, height, exits, roads, and        *
+ * buildings.  It reads nothing but its arguments, so it can run on the  *
+ * pre-generation worker.                                                */
+static void generate_map(map_t *m, uint32_t seed, int x, int y)
 {
+  rng_t r;
   int d, p;
   int e, w, n, s;
-  int x, y;
-  
-  if (world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]]) {
-    world.cur_map = world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]];
-    place_pc();
 
-    return 0;
-  }
+  rng_init(&r, seed, x, y, rng_map);
 
-  world.cur_map                                             =
-    world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]] =
-    (map_t *) malloc(sizeof (*world.cur_map));
+  smooth_height(m, &r);
 
-  smooth_height(world.cur_map);
-  
-  if (!world.cur_idx[dim_y]) {
+  /* Exits are hashed from the edge they're on, so that both maps along *
+   * an edge agree on them without either having to exist first.        */
+  if (!y) {
     n = -1;
-  } else if (world.world[world.cur_idx[dim_y] - 1][world.cur_idx[dim_x]]) {
-    n = world.world[world.cur_idx[dim_y] - 1][world.cur_idx[dim_x]]->s;
   } else {
-    n = 3 + rand() % (MAP_X - 6);
+    n = 3 + rng_hash(seed, x, y, rng_exit_ns) % (MAP_X - 6);
   }
-  if (world.cur_idx[dim_y] == WORLD_SIZE - 1) {
+  if (y == WORLD_SIZE - 1) {
     s = -1;
-  } else if (world.world[world.cur_idx[dim_y] + 1][world.cur_idx[dim_x]]) {
-    s = world.world[world.cur_idx[dim_y] + 1][world.cur_idx[dim_x]]->n;
-  } else  {
-    s = 3 + rand() % (MAP_X - 6);
+  } else {
+    s = 3 + rng_hash(seed, x, y + 1, rng_exit_ns) % (MAP_X - 6);
   }
-  if (!world.cur_idx[dim_x]) {
+  if (!x) {
     w = -1;
-  } else if (world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x] - 1]) {
-    w = world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x] - 1]->e;
   } else {
-    w = 3 + rand() % (MAP_Y - 6);
+    w = 3 + rng_hash(seed, x, y, rng_exit_ew) % (MAP_Y - 6);
   }
-  if (world.cur_idx[dim_x] == WORLD_SIZE - 1) {
+  if (x == WORLD_SIZE - 1) {
     e = -1;
-  } else if (world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x] + 1]) {
-    e = world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x] + 1]->w;
   } else {
-    e = 3 + rand() % (MAP_Y - 6);
+    e = 3 + rng_hash(seed, x + 1, y, rng_exit_ew) % (MAP_Y - 6);
   }
   
-  map_terrain(world.cur_map, n, s, e, w);
+  map_terrain(m, &r, n, s, e, w);
      
-  place_boulders(world.cur_map);
-  place_trees(world.cur_map);
-  build_paths(world.cur_map);
-  d = (abs(world.cur_idx[dim_x] - (WORLD_SIZE / 2)) +
-       abs(world.cur_idx[dim_y] - (WORLD_SIZE / 2)));
+  place_boulders(m, &r);
+  place_trees(m, &r);
+  build_paths(m);
+  d = abs(x - (WORLD_SIZE / 2)) + abs(y - (WORLD_SIZE / 2));
   p = d > 200 ? 5 : (50 - ((45 * d) / 200));
   //  printf("d=%d, p=%d\n", d, p);
-  if ((rand() % 100) < p || !d) {
-    place_pokemart(world.cur_map);
+  if ((rng_rand(&r) % 100) < p || !d) {
+    place_pokemart(m, &r);
   }
-  if ((rand() % 100) < p || !d) {
-    place_center(world.cur_map);
+  if ((rng_rand(&r) % 100) < p || !d) {
+    place_center(m, &r);
   }
+}
+
+/* A worker generates the neighbours of the current map while the      *
+ * player is busy with it.  new_map() queues them, and takes a finished *
+ * one when the player steps onto it, so that leaving a map costs only *
+ * placing the characters.  Maps are a pure function of the seed and    *
+ * their index, so one made ahead is the same as one made on the spot.  */
+typedef enum pregen_state {
+  pregen_queued,
+  pregen_busy,
+  pregen_ready
+} pregen_state_t;
+
+typedef struct pregen_map {
+  int16_t x, y;
+  uint32_t seed;
+  pregen_state_t state;
+  map_t *map;
+} pregen_map_t;
+
+static std::vector<pregen_map_t> pregen_maps;
+static std::mutex pregen_lock;
+static std::condition_variable pregen_wake, pregen_done;
+static std::thread pregen_thread;
+static int pregen_running, pregen_quit;
+
+static void pregen_main()
+{
+  std::unique_lock<std::mutex> l(pregen_lock);
+  pregen_map_t job;
+  map_t *m;
+  uint32_t i;
+
+  while (!pregen_quit) {
+    for (i = 0; i < pregen_maps.size(); i++) {
+      if (pregen_maps[i].state == pregen_queued) {
+        break;
+      }
+    }
+    if (i == pregen_maps.size()) {
+      pregen_wake.wait(l);
+      continue;
+    }
+
+    pregen_maps[i].state = pregen_busy;
+    job = pregen_maps[i];
+    l.unlock();
+    m = (map_t *) malloc(sizeof (*m));
+    generate_map(m, job.seed, job.x, job.y);
+    l.lock();
+
+    /* The queue may have changed, but nothing removes busy entries. */
+    for (i = 0; i < pregen_maps.size(); i++) {
+      if (pregen_maps[i].x == job.x && pregen_maps[i].y == job.y &&
+          pregen_maps[i].seed == job.seed) {
+        pregen_maps[i].state = pregen_ready;
+        pregen_maps[i].map = m;
+      }
+    }
+    pregen_done.notify_all();
+  }
+}
+
+static void pregen_join()
+{
+  {
+    std::lock_guard<std::mutex> l(pregen_lock);
+    pregen_quit = 1;
+  }
+  pregen_wake.notify_one();
+  pregen_thread.join();
+
+  for (pregen_map_t &p : pregen_maps) {
+    free(p.map);
+  }
+  pregen_maps.clear();
+}
+
+void pregen_start()
+{
+  pregen_running = 1;
+  pregen_thread = std::thread(pregen_main);
+  atexit(pregen_join);
+}
+
+/* Takes map (x, y) from the worker, waiting if it's being made, or    *
+ * returns NULL if it wasn't asked for.                                 */
+static map_t *pregen_take(int x, int y)
+{
+  std::unique_lock<std::mutex> l(pregen_lock);
+  map_t *m;
+  uint32_t i;
+
+  for (i = 0; i < pregen_maps.size(); i++) {
+    if (pregen_maps[i].x == x && pregen_maps[i].y == y &&
+        pregen_maps[i].seed == world.seed) {
+      break;
+    }
+  }
+  if (i == pregen_maps.size() || pregen_maps[i].state == pregen_queued) {
+    if (i < pregen_maps.size()) {
+      pregen_maps.erase(pregen_maps.begin() + i);
+    }
+    return NULL;
+  }
+
+  while (pregen_maps[i].state != pregen_ready) {
+    pregen_done.wait(l);
+  }
+  m = pregen_maps[i].map;
+  pregen_maps.erase(pregen_maps.begin() + i);
+
+  return m;
+}
+
+/* Queues the neighbours of the current map that don't exist yet, and *
+ * drops whatever was queued or made for anywhere else.                */
+static void pregen_neighbours()
+{
+  static const int8_t dir[4][2] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
+  std::lock_guard<std::mutex> l(pregen_lock);
+  pregen_map_t n;
+  uint32_t i;
+  int j;
+
+  if (!pregen_running) {
+    return;
+  }
+
+  for (i = 0; i < pregen_maps.size(); ) {
+    if (pregen_maps[i].state != pregen_busy &&
+        (pregen_maps[i].seed != world.seed ||
+         (abs(pregen_maps[i].x - world.cur_idx[dim_x]) +
+          abs(pregen_maps[i].y - world.cur_idx[dim_y]) != 1))) {
+      free(pregen_maps[i].map);
+      pregen_maps.erase(pregen_maps.begin() + i);
+    } else {
+      i++;
+    }
+  }
+
+  for (j = 0; j < 4; j++) {
+    n.x = world.cur_idx[dim_x] + dir[j][0];
+    n.y = world.cur_idx[dim_y] + dir[j][1];
+    if (n.x < 0 || n.x >= WORLD_SIZE || n.y < 0 || n.y >= WORLD_SIZE ||
+        world.world[n.y][n.x]) {
+      continue;
+    }
+    for (i = 0; i < pregen_maps.size(); i++) {
+      if (pregen_maps[i].x == n.x && pregen_maps[i].y == n.y &&
+          pregen_maps[i].seed == world.seed) {
+        break;
+      }
+    }
+    if (i == pregen_maps.size()) {
+      n.seed = world.seed;
+      n.state = pregen_queued;
+      n.map = NULL;
+      pregen_maps.push_back(n);
+    }
+  }
+
+  pregen_wake.notify_one();
+}
+
+/* Generates the maps in [x0, x1] x [y0, y1] on every core, for          *
+ * stress-testing generate_map().  Maps need nothing from each other, so  *
+ * threads just take the next index in turn.  There's no world file to   *
+ * save them to, so each map is hashed and freed.  The hashes are summed, *
+ * so the checksum doesn't depend on which thread made which map.        */
+static int generate_world(int x0, int y0, int x1, int y1)
+{
+  std::vector<std::thread> workers;
+  std::atomic<uint32_t> next(0);
+  std::atomic<uint64_t> checksum(0);
+  uint32_t count, threads, i;
+  double t;
+
+  count = (x1 - x0 + 1) * (y1 - y0 + 1);
+  threads = std::max(1u, std::thread::hardware_concurrency());
+
+  auto work = [&]() {
+    const uint8_t *b;
+    uint64_t h, sum;
+    uint32_t i, j;
+    map_t *m;
+    int x, y;
+
+    m = (map_t *) malloc(sizeof (*m));
+    for (sum = 0; (i = next++) < count; ) {
+      x = x0 + i % (x1 - x0 + 1);
+      y = y0 + i / (x1 - x0 + 1);
+      generate_map(m, world.seed, x, y);
+
+      h = 0xcbf29ce484222325ULL;
+      b = (const uint8_t *) m->map;
+      for (j = 0; j < sizeof (m->map); j++) {
+        h = (h ^ b[j]) * 0x100000001b3ULL;
+      }
+      b = (const uint8_t *) m->height;
+      for (j = 0; j < sizeof (m->height); j++) {
+        h = (h ^ b[j]) * 0x100000001b3ULL;
+      }
+      sum += rng_hash(h, x, y, 0);
+    }
+    free(m);
+    checksum += sum;
+  };
+
+  t = bench_now();
+  for (i = 1; i < threads; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  t = bench_now() - t;
+
+  printf("generate: %u maps from (%d, %d) to (%d, %d), %u threads\n",
+         count, x0, y0, x1, y1, threads);
+  printf("  %.2f s, %.0f maps per second\n", t, count / t);
+  printf("  checksum %016llx\n", (unsigned long long) checksum.load());
+
+  return 0;
+}
+
+int new_map(int teleport)
+{
+  int x, y;
+  
+  if (world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]]) {
+    world.cur_map = world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]];
+    place_pc();
+    pregen_neighbours();
+
+    return 0;
+  }
+
+  if (!(world.cur_map = pregen_take(world.cur_idx[dim_x],
+                                    world.cur_idx[dim_y]))) {
+    world.cur_map = (map_t *) malloc(sizeof (*world.cur_map));
+    generate_map(world.cur_map, world.seed,
+                 world.cur_idx[dim_x], world.cur_idx[dim_y]);
+  }
+  world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]] = world.cur_map;
+  pathfind_invalidate();
 
   for (y = 0; y < MAP_Y; y++) {
     for (x = 0; x < MAP_X; x++) {
@@ -928,7 +1191,8 @@ int new_map(int teleport)
     }
   }
 
-  heap_init(&world.cur_map->turn, cmp_char_turns, delete_character);
+  world.cur_map->turn.init();
+  heap_stats_site(&world.cur_map->turn, "turn queue");
 
   if ((world.cur_idx[dim_x] == WORLD_SIZE / 2) &&
       (world.cur_idx[dim_y] == WORLD_SIZE / 2)) {
@@ -938,6 +1202,7 @@ int new_map(int teleport)
   }
 
   if (teleport) {
+    pathfind_need(char_rival);
     do {
       world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = NULL;
       world.pc.pos[dim_x] = rand_range(1, MAP_X - 2);
@@ -954,6 +1219,8 @@ int new_map(int teleport)
   
   place_characters();
 
+  pregen_neighbours();
+
   return 0;
 }
 
@@ -1012,18 +1279,94 @@ static void print_map()
 // The world is global because of its size, so init_world is parameterless
 void init_world()
 {
+  world.seed = rand();
   world.quit = 0;
   world.cur_idx[dim_x] = world.cur_idx[dim_y] = WORLD_SIZE / 2;
   new_map(0);
 }
 
+/* Smooths maps of random heights both ways and checks that they agree. */
+int smooth_bench(int maps)
+{
+  static uint8_t in[MAP_Y][MAP_X], ref[MAP_Y][MAP_X], out[MAP_Y][MAP_X];
+  double t, ref_time, time;
+  int i, x, y, differ;
+
+  for (ref_time = time = 0, differ = 0, i = 1; i <= maps; i++) {
+    srand(i);
+    for (y = 0; y < MAP_Y; y++) {
+      for (x = 0; x < MAP_X; x++) {
+        in[y][x] = rand();
+      }
+    }
+
+    t = bench_now();
+    smooth_reference(in, ref);
+    ref_time += bench_now() - t;
+
+    t = bench_now();
+    smooth(in, out);
+    time += bench_now() - t;
+
+    differ += !!memcmp(ref, out, sizeof (out));
+  }
+
+  printf("smooth: %d maps\n", maps);
+  printf("  5x5 with bounds checks: %8.2f us per map\n",
+         ref_time * 1e6 / maps);
+  printf("  separable vectors:      %8.2f us per map\n", time * 1e6 / maps);
+  printf("  speedup %.2fx, %d maps differ\n", ref_time / time, differ);
+
+  return differ != 0;
+}
+
+/* Generates maps from seeds 1 through maps and reports how fast.  The *
+ * checksum covers terrain and height, so that builds can be checked    *
+ * against each other for generating the same maps.                     */
+int mapgen_bench(int maps)
+{
+  const uint8_t *b;
+  uint64_t sum;
+  double t, time;
+  uint32_t j;
+  int i;
+
+  for (time = 0, sum = 0xcbf29ce484222325ULL, i = 1; i <= maps; i++) {
+    srand(i);
+    t = bench_now();
+    init_world();
+    time += bench_now() - t;
+
+    b = (const uint8_t *) world.cur_map->height;
+    for (j = 0; j < sizeof (world.cur_map->height); j++) {
+      sum = (sum ^ b[j]) * 0x100000001b3ULL;
+    }
+    b = (const uint8_t *) world.cur_map->map;
+    for (j = 0; j < sizeof (world.cur_map->map); j++) {
+      sum = (sum ^ b[j]) * 0x100000001b3ULL;
+    }
+
+    delete_world();
+  }
+
+  printf("mapgen: %d maps, %.2f us per map, %.0f maps per second\n",
+         maps, time * 1e6 / maps, maps / time);
+  printf("  checksum %016llx\n", (unsigned long long) sum);
+
+  return 0;
+}
+
 void delete_world()
 {
+  uint32_t i;
   int x, y;
 
   //Only correct because current game never leaves the initial map
   //Need to iterate over all maps in 1.05+
-  heap_delete(&world.cur_map->turn);
+  for (i = 0; i < world.cur_map->turn.size(); i++) {
+    delete_character(world.cur_map->turn[i].value);
+  }
+  world.cur_map->turn.destroy();
 
   for (y = 0; y < WORLD_SIZE; y++) {
     for (x = 0; x < WORLD_SIZE; x++) {
@@ -1039,6 +1382,7 @@ void print_hiker_dist()
 {
   int x, y;
 
+  pathfind_need(char_hiker);
   for (y = 0; y < MAP_Y; y++) {
     for (x = 0; x < MAP_X; x++) {
       if (world.hiker_dist[y][x] == INT_MAX) {
@@ -1055,6 +1399,7 @@ void print_rival_dist()
 {
   int x, y;
 
+  pathfind_need(char_rival);
   for (y = 0; y < MAP_Y; y++) {
     for (x = 0; x < MAP_X; x++) {
       if (world.rival_dist[y][x] == INT_MAX || world.rival_dist[y][x] < 0) {
@@ -1105,7 +1450,7 @@ void game_loop()
   io_choose_starter();
 
   while (!world.quit) {
-    c = (character *) heap_remove_min(&world.cur_map->turn);
+    c = world.cur_map->turn.remove_min();
     is_pc = dynamic_cast<npc *>(c) == NULL;
 
     move_func[is_pc ? move_pc : ((npc *) c)->mtype](c, d);
@@ -1135,13 +1480,14 @@ void game_loop()
     c->pos[dim_y] = d[dim_y];
     c->pos[dim_x] = d[dim_x];
 
-    heap_insert(&world.cur_map->turn, c);
+    world.cur_map->turn.insert(c->next_turn, c);
   }
 }
 
 void usage(char *s)
 {
-  fprintf(stderr, "Usage: %s [-s|--seed <seed>]\n", s);
+  fprintf(stderr, "Usage: %s [-s|--seed <seed>] [-b|--bench <name> |\n"
+          "          -g|--generate all|<x0>,<y0>,<x1>,<y1>]\n", s);
 
   exit(1);
 }
@@ -1152,11 +1498,16 @@ int main(int argc, char *argv[])
   uint32_t seed;
   int long_arg;
   int do_seed;
+  const char *bench;
+  const char *generate;
+  int x0, y0, x1, y1;
   //  char c;
   //  int x, y;
   int i;
 
   do_seed = 1;
+  bench = NULL;
+  generate = NULL;
   
   if (argc > 1) {
     for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
@@ -1175,6 +1526,22 @@ int main(int argc, char *argv[])
           }
           do_seed = 0;
           break;
+        case 'b':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-bench")) ||
+              argc < ++i + 1 /* No more arguments */) {
+            usage(argv[0]);
+          }
+          bench = argv[i];
+          break;
+        case 'g':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-generate")) ||
+              argc < ++i + 1 /* No more arguments */) {
+            usage(argv[0]);
+          }
+          generate = argv[i];
+          break;
         default:
           usage(argv[0]);
         }
@@ -1184,6 +1551,10 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (bench && generate) { /* Each replaces the game; pick one */
+    usage(argv[0]);
+  }
+
   if (do_seed) {
     /* Allows me to start the game more than once *
      * per second, as opposed to time().          */
@@ -1194,10 +1565,30 @@ int main(int argc, char *argv[])
   printf("Using seed: %u\n", seed);
   srand(seed);
 
+  if (generate) {
+    if (!strcmp(generate, "all")) {
+      x0 = y0 = 0;
+      x1 = y1 = WORLD_SIZE - 1;
+    } else if (sscanf(generate, "%d,%d,%d,%d", &x0, &y0, &x1, &y1) != 4 ||
+               x0 < 0 || y0 < 0 || x1 >= WORLD_SIZE || y1 >= WORLD_SIZE ||
+               x0 > x1 || y0 > y1) {
+      usage(argv[0]);
+    }
+    world.seed = rand(); /* As init_world() does */
+    return generate_world(x0, y0, x1, y1);
+  }
+
+  if (bench) {
+    i = bench_run(bench);
+    heap_stats_print(stdout);
+    return i ? 1 : 0;
+  }
+
   db_parse(false);
 
   io_init_terminal();
   
+  pregen_start();
   init_world();
 
   /* print_hiker_dist(); */
@@ -1268,6 +1659,8 @@ int main(int argc, char *argv[])
   delete_world();
 
   io_reset_terminal();
+
+  heap_stats_print(stderr);
   
   return 0;
 }
@@ -5,6 +5,7 @@
 # include <assert.h>
 
 # include "heap.h"
+# include "pqueue.h"
 # include <vector>
 # include "pair.h"
 # include "pokemon.h"
@@ -119,16 +120,27 @@ extern const char *char_type_name[num_character_types];
 
 extern int32_t move_cost[num_character_types][num_terrain_types];
 
+/* Characters keyed by next_turn. */
+typedef pqueue<int, character *> turn_queue_t;
+
 typedef struct map {
   terrain_type_t map[MAP_Y][MAP_X];
   uint8_t height[MAP_Y][MAP_X];
   character *cmap[MAP_Y][MAP_X];
-  heap_t turn;
+  turn_queue_t turn;
   int32_t num_trainers;
   int8_t n, s, e, w;
 } map_t;
 
 void pathfind(map_t *m);
+void pathfind_need(character_type_t ctype);
+void pathfind_invalidate();
+void pathfind_around(character_type_t ctype, const pair_t pos, int around[8]);
+int pathfind_bench(int maps);
+int steering_bench(int maps);
+int heap_bench(int maps);
+int mapgen_bench(int maps);
+int smooth_bench(int maps);
 extern void (*move_func[num_movement_types])(character *, pair_t);
 
 typedef struct world {
@@ -143,6 +155,9 @@ typedef struct world {
   std::vector<pokemon*> poke_pc;
   int quit;
   int add_trainer_prob;
+  /* Maps are generated from hashes of this and their coordinates, and *
+   * come out the same in whatever order they're visited.              */
+  uint32_t seed;
 } world_t;
 
 /* Even unallocated, a WORLD_SIZE x WORLD_SIZE array of pointers is a very *
@@ -165,5 +180,9 @@ typedef struct path {
 } path_t;
 
 int new_map(int teleport);
+void pregen_start();
+void rand_pos(pair_t pos);
+void init_world();
+void delete_world();
 
 #endif
@@ -1,75 +1,39 @@
 #include <cstdlib>
-#include <algorithm>
 #include <math.h>
 
 #include "pokemon.h"
 #include "db_parse.h"
 
-static bool operator<(const levelup_move &f, const levelup_move &s)
-{
-  return ((f.level < s.level) || ((f.level == s.level) && f.move < s.move));
-}
-
 pokemon::pokemon(int level) : level(level)
 {
-  pokemon_species_db *s;
-  unsigned i, j;
-  bool found;
+  const pokemon_species_db *s;
+  const levelup_move *l;
+  unsigned i, j, n;
 
   // Subtract 1 because array is 1-indexed
-  pokemon_species_index = rand() % ((sizeof (species) /
-                                     sizeof (species[0])) - 1);
+  pokemon_species_index = rand() % (NUM_SPECIES - 1);
   s = species + pokemon_species_index;
-  
-  if (!s->levelup_moves.size()) {
-    // We have never generated a pokemon of this species before, so we
-    // need to find it's level-up moveset and save it for next time.
-    for (i = 1; i < (sizeof (pokemon_moves) /
-                     sizeof (pokemon_moves[0])); i++) {
-      if (s->id == pokemon_moves[i].pokemon_id &&
-          pokemon_moves[i].pokemon_move_method_id == 1) {
-        for (found = false, j = 0; !found && j < s->levelup_moves.size(); j++) {
-          if (s->levelup_moves[j].move == pokemon_moves[i].move_id) {
-            found = true;
-          }
-        }
-        if (!found) {
-          s->levelup_moves.push_back({ pokemon_moves[i].level,
-                                       pokemon_moves[i].move_id });
-        }
-      }
-    }
 
-    // s->levelup_moves now contains all of the moves this species can learn
-    // through leveling up.  Now we'll sort it by level to make that process
-    // simpler.
-    sort(s->levelup_moves.begin(), s->levelup_moves.end());
-
-    // Also initialize base stats while we're here
-    s->base_stat[0] = pokemon_stats[pokemon_species_index * 6 - 5].base_stat;
-    s->base_stat[1] = pokemon_stats[pokemon_species_index * 6 - 4].base_stat;
-    s->base_stat[2] = pokemon_stats[pokemon_species_index * 6 - 3].base_stat;
-    s->base_stat[3] = pokemon_stats[pokemon_species_index * 6 - 2].base_stat;
-    s->base_stat[4] = pokemon_stats[pokemon_species_index * 6 - 1].base_stat;
-    s->base_stat[5] = pokemon_stats[pokemon_species_index * 6 - 0].base_stat;
-  }
+  // Level-up moves were indexed and sorted by level when the pokedex was
+  // loaded, so we only have to look at this species' moves.
+  l = learnset + learnset_offset[pokemon_species_index];
+  n = (learnset_offset[pokemon_species_index + 1] -
+       learnset_offset[pokemon_species_index]);
 
   // Get pokemon's move(s).
-  for (i = 0;
-       i < s->levelup_moves.size() && s->levelup_moves[i].level <= level;
-       i++)
+  for (i = 0; i < n && l[i].level <= level; i++)
     ;
 
   // 0 is an invalid index, since the array is 1 indexed.
   move_index[0] = move_index[1] = move_index[2] = move_index[3] = 0;
   // I don't think 0 moves is possible, but account for it to be safe
   if (i) {
-    move_index[0] = s->levelup_moves[rand() % i].move;
+    move_index[0] = l[rand() % i].move;
     if (i != 1) {
       do {
         j = rand() % i;
-      } while (s->levelup_moves[j].move == move_index[0]);
-      move_index[1] = s->levelup_moves[j].move;
+      } while (l[j].move == move_index[0]);
+      move_index[1] = l[j].move;
     }
   }
 
@@ -95,7 +59,7 @@ pokemon::pokemon(int level) : level(level)
 
 const char *pokemon::get_species() const
 {
-  return species[pokemon_species_index].identifier;
+  return db_string(species[pokemon_species_index].identifier);
 }
 
 int pokemon::get_level(){
@@ -164,7 +128,7 @@ bool pokemon:: is_fainted(){
 const char *pokemon::get_move(int i) const
 {
   if (i < 4 && move_index[i]) {
-    return moves[move_index[i]].identifier;
+    return db_string(moves[move_index[i]].identifier);
   } else {
     return "";
   }
@@ -0,0 +1,146 @@
+#ifndef PQUEUE_H
+# define PQUEUE_H
+
+# include <stdint.h>
+# include <stdlib.h>
+# include <assert.h>
+# include <functional>
+# include <type_traits>
+
+# include "heap.h"
+
+/* A priority queue that stores each key next to its value, so ordering *
+ * two entries is an inlined compare of two keys.  heap_t has to call   *
+ * through a function pointer, which then has to chase the data to find  *
+ * the keys.  It's an implicit 4-ary heap: entries live in one array,    *
+ * the children of entry i are 4i + 1 through 4i + 4, and sifting moves  *
+ * entries instead of relinking nodes.                                   *
+ *                                                                       *
+ * A key is copied in when its value is inserted, and changing it means  *
+ * inserting the value again.  There is no decrease-key; Dijkstra-style  *
+ * callers insert the value again with its lower key and skip the stale  *
+ * entry when it comes out.                                              *
+ *                                                                       *
+ * Like heap_t, a pqueue is plain data that can live in malloc()ed       *
+ * structs, so it has init() and destroy() instead of a constructor and  *
+ * a destructor, and keys and values have to be trivially copyable.      *
+ *                                                                       *
+ * With HEAP_STATS, it counts into heap_stats_site() sites like heap_t.   */
+template <class key_type, class value_type,
+          class compare = std::less<key_type> >
+class pqueue {
+ public:
+  typedef struct entry {
+    key_type key;
+    value_type value;
+  } entry_t;
+
+  static_assert(std::is_trivially_copyable<entry_t>::value,
+                "pqueue entries are moved with realloc()");
+
+  void init()
+  {
+    e = NULL;
+    n = capacity = 0;
+    heap_stats_site(this, "other");
+  }
+
+  void destroy()
+  {
+    free(e);
+    init();
+  }
+
+  /* Empties the queue, keeping its storage. */
+  void clear()
+  {
+    n = 0;
+  }
+
+  uint32_t size() const
+  {
+    return n;
+  }
+
+  /* Entries in no particular order, for walking the whole queue. */
+  const entry_t &operator[](uint32_t i) const
+  {
+    return e[i];
+  }
+
+  const entry_t *peek_min() const
+  {
+    return n ? e : NULL;
+  }
+
+  void insert(const key_type &key, const value_type &value)
+  {
+    uint32_t i, p;
+
+    if (n == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      assert((e = (entry_t *) realloc(e, capacity * sizeof (*e))));
+    }
+
+    for (i = n++; i; i = p) {
+      p = (i - 1) / 4;
+      if (!compare()(key, e[p].key)) {
+        break;
+      }
+      e[i] = e[p];
+    }
+    e[i].key = key;
+    e[i].value = value;
+
+# ifdef HEAP_STATS
+    heap_stats_add(stats->inserts, 1);
+    heap_stats_max(&stats->peak_size, n);
+# endif
+  }
+
+  /* The queue must not be empty. */
+  value_type remove_min(key_type *key = NULL)
+  {
+    value_type v;
+    entry_t last;
+    uint32_t i, c, j, min;
+
+    assert(n);
+
+# ifdef HEAP_STATS
+    heap_stats_add(stats->removes, 1);
+# endif
+
+    if (key) {
+      *key = e[0].key;
+    }
+    v = e[0].value;
+    last = e[--n];
+
+    for (i = 0; (c = 4 * i + 1) < n; i = min) {
+      for (min = c, j = c + 1; j < c + 4 && j < n; j++) {
+        if (compare()(e[j].key, e[min].key)) {
+          min = j;
+        }
+      }
+      if (!compare()(e[min].key, last.key)) {
+        break;
+      }
+      e[i] = e[min];
+    }
+    e[i] = last;
+
+    return v;
+  }
+
+# ifdef HEAP_STATS
+  heap_stats_t *stats;
+# endif
+
+ private:
+  entry_t *e;
+  uint32_t n;
+  uint32_t capacity;
+};
+
+#endif
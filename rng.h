@@ -0,0 +1,51 @@
+#ifndef RNG_H
+# define RNG_H
+
+# include <stdint.h>
+
+/* A splitmix64 stream for generating one map.  Its starting state is  *
+ * a hash of the world seed and the map's coordinates, so every map has *
+ * its own stream, and its contents don't depend on which maps were    *
+ * made before it or on what else has called rand() in the meantime.    */
+typedef struct rng {
+  uint64_t state;
+} rng_t;
+
+# define RNG_GOLDEN 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t rng_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+/* A hash of seed, x, y and a stream number that tells apart things  *
+ * keyed by the same coordinates.                                    */
+static inline uint64_t rng_hash(uint64_t seed, int32_t x, int32_t y,
+                                uint32_t stream)
+{
+  uint64_t h;
+
+  h = rng_mix(seed + RNG_GOLDEN);
+  h = rng_mix(h ^ ((uint64_t) (uint32_t) x << 32 | (uint32_t) y));
+
+  return rng_mix(h ^ stream);
+}
+
+static inline void rng_init(rng_t *r, uint64_t seed, int32_t x, int32_t y,
+                            uint32_t stream)
+{
+  r->state = rng_hash(seed, x, y, stream);
+}
+
+/* Like rand(): uniform in [0, 2^31 - 1]. */
+static inline int rng_rand(rng_t *r)
+{
+  r->state += RNG_GOLDEN;
+
+  return (int) (rng_mix(r->state) >> 33);
+}
+
+#endif